@@ -0,0 +1,1089 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <new>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <zlib.h>
+#include "csvparser.h"
+#include "csvparallel.h"
+#include "csvreader.h"
+#include "csvzinput.h"
+#include "csvwriter.h"
+#include "csvoutbuf.h"
+#include "csvthreads.h"
+#include "simplecsv.h"
+#include "nocase.h"
+
+// {{{ allocation counting
+static size_t alloc_count=0,alloc_bytes=0;
+
+void *operator new(size_t size)
+{
+  alloc_count++;
+  alloc_bytes+=size;
+  void *ret=malloc(size ? size : 1);
+  if (!ret) {
+    throw std::bad_alloc();
+  }
+  return ret;
+}
+
+void operator delete(void *ptr) throw()
+{
+  free(ptr);
+}
+
+void operator delete(void *ptr,size_t) throw()
+{
+  free(ptr);
+}
+// }}}
+
+static double now() // {{{
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+// }}}
+
+// deterministic (LCG)
+static void gen_table(std::string &ret,int rows,int cols) // {{{
+{
+  unsigned int seed=12345;
+  char buf[32];
+  for (int iA=0;iA<rows;iA++) {
+    for (int iB=0;iB<cols;iB++) {
+      if (iB) {
+        ret.push_back(',');
+      }
+      seed=seed*1103515245+12345;
+      if (iB%4==3) {
+        ret.append("text value ");
+      }
+      snprintf(buf,sizeof(buf),"%u",seed>>8);
+      ret.append(buf);
+    }
+    ret.push_back('\n');
+  }
+}
+// }}}
+
+// {{{ corpus shapes (deterministic)
+enum Shape { NarrowNumeric, WideText, QuoteHeavy, Sparse, MultiLine, NumShapes };
+static const char *const shape_names[NumShapes]={
+  "narrow_numeric","wide_text","quote_heavy","sparse","multiline"
+};
+
+struct Corpus {
+  Corpus() : rows(0),cells(0) {}
+
+  std::string data;
+  size_t rows,cells;
+};
+
+struct lcg {
+  explicit lcg(unsigned int seed) : seed(seed) {}
+  unsigned int operator()(unsigned int mod) {
+    seed=seed*1103515245+12345;
+    return (seed>>8)%mod;
+  }
+  unsigned int seed;
+};
+
+static void gen_word(std::string &ret,lcg &rnd,int minlen,int maxlen) // {{{
+{
+  const int len=minlen+rnd(maxlen-minlen+1);
+  for (int iA=0;iA<len;iA++) {
+    ret.push_back('a'+rnd(26));
+  }
+}
+// }}}
+
+// until at least bytes; (rows end with \n)
+static void gen_corpus(Corpus &ret,Shape shape,size_t bytes) // {{{
+{
+  static const int cols[NumShapes]={4,40,8,12,3};
+  lcg rnd(4711+shape);
+  char buf[64];
+  std::string &out=ret.data;
+  out.clear();
+  ret.rows=ret.cells=0;
+  while (out.size()<bytes) {
+    for (int iB=0;iB<cols[shape];iB++) {
+      if (iB) {
+        out.push_back(',');
+      }
+      switch (shape) {
+      case NarrowNumeric:
+        if (iB&1) {
+          snprintf(buf,sizeof(buf),"%u.%02u",rnd(100000),rnd(100));
+        } else {
+          snprintf(buf,sizeof(buf),"%u",rnd(1u<<30));
+        }
+        out.append(buf);
+        break;
+      case WideText:
+        gen_word(out,rnd,3,10);
+        out.push_back(' ');
+        gen_word(out,rnd,2,12);
+        break;
+      case QuoteHeavy: // embedded qchars, separators
+        out.push_back('"');
+        gen_word(out,rnd,0,6);
+        out.append("\"\",");
+        gen_word(out,rnd,1,8);
+        out.append((rnd(2)) ? "\"\"\"\"" : ", ");
+        out.push_back('"');
+        break;
+      case Sparse: // mostly NULL, some empty ("")
+        switch (rnd(10)) {
+        case 0: case 1: case 2:
+          gen_word(out,rnd,1,8);
+          break;
+        case 3:
+          out.append("\"\"");
+          break;
+        }
+        break;
+      case MultiLine:
+        if (iB==1) {
+          out.push_back('"');
+          for (int lines=1+rnd(20);lines>0;lines--) {
+            gen_word(out,rnd,20,100);
+            out.push_back('\n');
+          }
+          out.push_back('"');
+        } else {
+          snprintf(buf,sizeof(buf),"%u",rnd(1000000));
+          out.append(buf);
+        }
+        break;
+      case NumShapes:
+        break;
+      }
+    }
+    out.push_back('\n');
+    ret.rows++;
+    ret.cells+=cols[shape];
+  }
+}
+// }}}
+// }}}
+
+static void bench_table_alloc(const std::string &input,int rows,int cols) // {{{
+{
+  size_t count0,bytes0,count1,bytes1;
+  double t0,t1;
+  {
+    SimpleCSV::Table tbl;
+    count0=alloc_count;
+    bytes0=alloc_bytes;
+    t0=now();
+    {
+      SimpleCSV::builder bld(tbl);
+      csvparser cp(bld);
+      cp(input);
+      cp.finish();
+    }
+    t1=now();
+    count1=alloc_count;
+    bytes1=alloc_bytes;
+  } // (destroys tbl)
+  const double t2=now();
+
+  printf("{\"bench\":\"table_alloc\",\"rows\":%d,\"cols\":%d,"
+         "\"allocs\":%lu,\"alloc_bytes\":%lu,\"allocs_per_row\":%.3f,"
+         "\"load_s\":%.6f,\"destroy_s\":%.6f}\n",
+         rows,cols,
+         (unsigned long)(count1-count0),(unsigned long)(bytes1-bytes0),(double)(count1-count0)/rows,
+         t1-t0,t2-t1);
+}
+// }}}
+
+// counts cells; does not derive from csv_builder (only for basic_csvparser)
+struct count_builder { // {{{
+  count_builder() : rows(0),cells(0),bytes(0) {}
+
+  void begin_row() {}
+  void cell(const char *buf,int len) {
+    cells++;
+    bytes+=len;
+  }
+  void end_row() {
+    rows++;
+  }
+
+  size_t rows,cells,bytes;
+};
+// }}}
+
+class virtual_count_builder : public csv_builder { // {{{
+public:
+  void cell(const char *buf,int len) {
+    cnt.cell(buf,len);
+  }
+  void end_row() {
+    cnt.end_row();
+  }
+
+  count_builder cnt;
+};
+// }}}
+
+template <typename Parser>
+static double parse_input(Parser &cp,const std::string &input) // {{{
+{
+  cp.set_zero_copy(true);
+  const double t0=now();
+  cp(input);
+  cp.finish();
+  return now()-t0;
+}
+// }}}
+
+// csvparser (virtual csv_builder) vs. basic_csvparser<Builder>
+static void bench_dispatch(const std::string &input) // {{{
+{
+  virtual_count_builder vcnt;
+  csvparser cp1(vcnt);
+  const double t1=parse_input(cp1,input);
+
+  count_builder cnt;
+  basic_csvparser<count_builder> cp2(cnt);
+  const double t2=parse_input(cp2,input);
+
+  printf("{\"bench\":\"dispatch\",\"sink\":\"count\",\"bytes\":%lu,\"cells\":%lu,"
+         "\"virtual_mb_s\":%.1f,\"static_mb_s\":%.1f}\n",
+         (unsigned long)input.size(),(unsigned long)cnt.cells,
+         input.size()/t1/1e6,input.size()/t2/1e6);
+  assert( (cnt.cells==vcnt.cnt.cells)&&(cnt.bytes==vcnt.cnt.bytes) );
+
+  // parse -> re-emit
+  csv_writer<csv_outbuf> wr1;
+  csvparser cp3(wr1);
+  const double t3=parse_input(cp3,input);
+
+  csv_writer<csv_outbuf> wr2;
+  basic_csvparser<csv_writer<csv_outbuf> > cp4(wr2);
+  const double t4=parse_input(cp4,input);
+
+  printf("{\"bench\":\"dispatch\",\"sink\":\"csv_writer\",\"bytes\":%lu,\"identical\":%s,"
+         "\"virtual_mb_s\":%.1f,\"static_mb_s\":%.1f}\n",
+         (unsigned long)input.size(),
+         ( (wr1.output().size()==wr2.output().size())&&
+           (memcmp(wr1.output().data(),wr2.output().data(),wr1.output().size())==0) ) ? "true" : "false",
+         input.size()/t3/1e6,input.size()/t4/1e6);
+}
+// }}}
+
+// csv_nostats (default) vs. csv_stats vs. csv_timed_stats
+static void bench_stats(const std::string &input) // {{{
+{
+  count_builder cnt1;
+  basic_csvparser<count_builder> cp1(cnt1);
+  const double t1=parse_input(cp1,input);
+
+  count_builder cnt2;
+  basic_csvparser<count_builder,csv_stats> cp2(cnt2);
+  const double t2=parse_input(cp2,input);
+
+  virtual_count_builder vcnt;
+  basic_csvparser<csv_builder,csv_timed_stats> cp3(vcnt);
+  const double t3=parse_input(cp3,input);
+
+  const csv_stats &st=cp3.stats();
+  printf("{\"bench\":\"stats\",\"bytes\":%lu,\"rows\":%lu,\"cells\":%lu,\"quoted\":%lu,"
+         "\"max_cell_len\":%d,\"nostats_mb_s\":%.1f,\"stats_mb_s\":%.1f,\"timed_mb_s\":%.1f,"
+         "\"timed_parse_s\":%.4f,\"timed_builder_s\":%.4f}\n",
+         (unsigned long)st.bytes,(unsigned long)st.rows,(unsigned long)st.cells,
+         (unsigned long)st.quoted_cells,st.max_cell_len,
+         input.size()/t1/1e6,input.size()/t2/1e6,input.size()/t3/1e6,
+         st.parse_ns()*1e-9,st.builder_ns*1e-9);
+  assert( (cnt1.cells==cnt2.cells)&&(cp2.stats().cells==cnt1.cells)&&(st.bytes==input.size()) );
+}
+// }}}
+
+// pull-style csvreader over fixed-size chunks: allocations after the first chunks
+static void bench_reader(const std::string &input,int rows) // {{{
+{
+  const size_t chunk=64*1024;
+  csvreader rd;
+  csv_row row;
+  size_t nrows=0,bytes=0,count0=0;
+  const double t0=now();
+  for (size_t off=0;off<input.size();off+=chunk) {
+    if (off==4*chunk) { // (warm-up)
+      count0=alloc_count;
+    }
+    const size_t len=(input.size()-off<chunk) ? input.size()-off : chunk;
+    rd.feed(input.data()+off,len);
+    while (rd.next_row(row)) {
+      nrows++;
+      for (int iA=0;iA<row.size();iA++) {
+        bytes+=row[iA].len;
+      }
+    }
+  }
+  rd.finish();
+  while (rd.next_row(row)) {
+    nrows++;
+  }
+  const double t=now()-t0;
+
+  printf("{\"bench\":\"reader\",\"rows\":%lu,\"chunk\":%lu,\"steady_allocs\":%lu,\"mb_s\":%.1f}\n",
+         (unsigned long)nrows,(unsigned long)chunk,(unsigned long)(alloc_count-count0),
+         input.size()/t/1e6);
+  assert(nrows==(size_t)rows);
+}
+// }}}
+
+// SimpleCSV load of a wide table: all columns vs. 3 projected ones
+static void bench_projection(int rows,int cols) // {{{
+{
+  std::string input;
+  gen_table(input,rows,cols);
+  std::vector<int> cidxs;
+  cidxs.push_back(1);
+  cidxs.push_back(cols/2);
+  cidxs.push_back(cols-1);
+
+  for (int projected=0;projected<2;projected++) {
+    SimpleCSV::Table tbl;
+    const size_t bytes0=alloc_bytes;
+    const double t0=now();
+    {
+      SimpleCSV::builder bld(tbl);
+      if (projected) {
+        bld.project(cidxs);
+      }
+      csvparser cp(bld);
+      cp.set_projection(bld.projection());
+      cp(input);
+      cp.finish();
+    }
+    const double t=now()-t0;
+
+    printf("{\"bench\":\"projection\",\"rows\":%d,\"cols\":%d,\"kept\":%d,"
+           "\"alloc_bytes\":%lu,\"load_s\":%.6f}\n",
+           rows,cols,(projected) ? (int)cidxs.size() : cols,
+           (unsigned long)(alloc_bytes-bytes0),t);
+  }
+}
+// }}}
+
+// SimpleCSV load, dropping ~90% of the rows by a predicate on the first column
+static void bench_predicate(const std::string &input,int rows) // {{{
+{
+  for (int filtered=0;filtered<2;filtered++) {
+    SimpleCSV::Table tbl;
+    const size_t count0=alloc_count;
+    const double t0=now();
+    {
+      SimpleCSV::builder bld(tbl);
+      if (filtered) {
+        bld.where(0,SimpleCSV::Predicate::range(0,(1<<24)/10));
+      }
+      csvparser cp(bld);
+      cp.set_projection(bld.projection());
+      cp(input);
+      cp.finish();
+    }
+    const double t=now()-t0;
+
+    printf("{\"bench\":\"predicate\",\"rows\":%d,\"kept_rows\":%d,"
+           "\"allocs\":%lu,\"load_s\":%.6f}\n",
+           rows,tbl.size(),(unsigned long)(alloc_count-count0),t);
+  }
+}
+// }}}
+
+// access by name: case-insensitive multimap (as before), Row::operator[](const char *), Column handle
+static void bench_lookup(const std::string &input,int rows,int cols) // {{{
+{
+  SimpleCSV::Table tbl;
+  SimpleCSV::builder bld(tbl);
+  csvparser cp(bld);
+  cp(input);
+  cp.finish();
+
+  std::vector<std::string> names;
+  std::multimap<std::string,int,lt_nocase_str> rev_column;
+  for (int iA=0;iA<cols;iA++) {
+    char buf[32];
+    snprintf(buf,sizeof(buf),"Column_%d",iA);
+    names.push_back(buf);
+    rev_column.insert(std::make_pair(names.back(),iA));
+  }
+  SimpleCSV::Table::IBuild::setHeader(tbl,names);
+  const char *key="column_7";
+
+  size_t sum[3]={0,0,0};
+  double t[3];
+  t[0]=now();
+  for (int iA=0;iA<rows;iA++) {
+    const int cidx=rev_column.find(key)->second;
+    sum[0]+=tbl[iA][cidx].asInt64();
+  }
+  t[0]=now()-t[0];
+
+  t[1]=now();
+  for (int iA=0;iA<rows;iA++) {
+    sum[1]+=tbl[iA][key].asInt64();
+  }
+  t[1]=now()-t[1];
+
+  t[2]=now();
+  const SimpleCSV::Column col=tbl.column(key);
+  for (int iA=0;iA<rows;iA++) {
+    sum[2]+=tbl[iA][col].asInt64();
+  }
+  t[2]=now()-t[2];
+
+  printf("{\"bench\":\"lookup\",\"rows\":%d,\"identical\":%s,"
+         "\"multimap_ns\":%.1f,\"name_ns\":%.1f,\"column_ns\":%.1f}\n",
+         rows,( (sum[0]==sum[1])&&(sum[1]==sum[2]) ) ? "true" : "false",
+         t[0]/rows*1e9,t[1]/rows*1e9,t[2]/rows*1e9);
+}
+// }}}
+
+// key lookups: scan vs. HashIndex (incl. build)
+static void bench_index(const std::string &input,int rows) // {{{
+{
+  SimpleCSV::Table tbl;
+  SimpleCSV::builder bld(tbl);
+  csvparser cp(bld);
+  cp(input);
+  cp.finish();
+
+  const int lookups=100;
+  std::vector<int> res;
+  size_t found[2]={0,0};
+  double t[3];
+  t[0]=now();
+  for (int iA=0;iA<lookups;iA++) {
+    tbl.lookup(1,tbl[iA*(rows/lookups)][1].asString(),res);
+    found[0]+=res.size();
+  }
+  t[0]=now()-t[0];
+
+  SimpleCSV::Table::IBuild::addIndex(tbl,1,SimpleCSV::HashIndex);
+  t[1]=now();
+  tbl.lookup(1,"",res); // (builds)
+  t[1]=now()-t[1];
+
+  t[2]=now();
+  for (int iA=0;iA<lookups;iA++) {
+    tbl.lookup(1,tbl[iA*(rows/lookups)][1].asString(),res);
+    found[1]+=res.size();
+  }
+  t[2]=now()-t[2];
+
+  printf("{\"bench\":\"index\",\"rows\":%d,\"identical\":%s,"
+         "\"scan_us\":%.1f,\"build_s\":%.6f,\"hash_us\":%.3f}\n",
+         rows,(found[0]==found[1]) ? "true" : "false",
+         t[0]/lookups*1e6,t[1],t[2]/lookups*1e6);
+}
+// }}}
+
+// delete every other row (dedup pattern): vector::erase per row (as before), deleteRow, deleteRows
+static void bench_row_delete(int rows) // {{{
+{
+  double t[3];
+  {
+    std::vector<size_t> ref(rows);
+    t[0]=now();
+    for (int iA=0;iA<(int)ref.size();iA++) {
+      ref.erase(ref.begin()+iA);
+    }
+    t[0]=now()-t[0];
+  }
+  int left[2];
+  for (int batch=0;batch<2;batch++) {
+    SimpleCSV::Table tbl;
+    for (int iA=0;iA<rows;iA++) {
+      SimpleCSV::Table::IBuild::newRow(tbl);
+    }
+    t[batch+1]=now();
+    if (batch) {
+      std::vector<int> del;
+      for (int iA=1;iA<rows;iA+=2) {
+        del.push_back(iA);
+      }
+      SimpleCSV::Table::IBuild::deleteRows(tbl,del);
+    } else {
+      for (int iA=1;iA<tbl.size();iA++) {
+        SimpleCSV::Table::IBuild::deleteRow(tbl,iA);
+        tbl[iA-1]; // (interleaved access)
+      }
+    }
+    t[batch+1]=now()-t[batch+1];
+    left[batch]=tbl.size();
+  }
+  // queue: delete the first row, append one (tombstones are kept by newRow)
+  double tq;
+  {
+    SimpleCSV::Table tbl;
+    for (int iA=0;iA<rows;iA++) {
+      SimpleCSV::Table::IBuild::newRow(tbl);
+    }
+    tq=now();
+    for (int iA=0;iA<rows;iA++) {
+      SimpleCSV::Table::IBuild::deleteRow(tbl,0);
+      SimpleCSV::Table::IBuild::newRow(tbl);
+    }
+    tq=now()-tq;
+  }
+
+  printf("{\"bench\":\"row_delete\",\"rows\":%d,\"left\":%d,\"identical\":%s,"
+         "\"vector_erase_s\":%.6f,\"delete_row_s\":%.6f,\"delete_rows_s\":%.6f,"
+         "\"delete_append_s\":%.6f}\n",
+         rows,left[0],(left[0]==left[1]) ? "true" : "false",t[0],t[1],t[2],tq);
+}
+// }}}
+
+// Table::write through one csv_writer vs. Table::write_parallel (into memory)
+static void bench_write_parallel(const std::string &input,int rows) // {{{
+{
+  SimpleCSV::Table tbl;
+  SimpleCSV::builder bld(tbl);
+  csvparser cp(bld);
+  cp(input);
+  cp.finish();
+
+  csv_writer<csv_outbuf> wr('"',',',true);
+  double t0=now();
+  tbl.write(wr);
+  const double t1=now()-t0;
+
+  const int threads=csv_threads(0);
+  csv_outbuf out;
+  t0=now();
+  tbl.write_parallel(out,false,threads,'"',',',true);
+  const double t2=now()-t0;
+
+  printf("{\"bench\":\"write_parallel\",\"rows\":%d,\"threads\":%d,\"bytes\":%lu,\"identical\":%s,"
+         "\"write_mb_s\":%.1f,\"parallel_mb_s\":%.1f}\n",
+         rows,threads,(unsigned long)out.size(),
+         ( (out.size()==wr.output().size())&&(memcmp(out.data(),wr.output().data(),out.size())==0) ) ? "true" : "false",
+         out.size()/t1/1e6,out.size()/t2/1e6);
+}
+// }}}
+
+// csvparser vs. csvparallel: ordered (replayed into one builder) and per-chunk builders
+static void bench_parallel(const std::string &input) // {{{
+{
+  virtual_count_builder cnt0;
+  csvparser cp(cnt0);
+  double t0=now();
+  cp(input);
+  cp.finish();
+  const double t1=now()-t0;
+
+  const int threads=(csv_threads(0)>1) ? csv_threads(0) : 2;
+  csvparallel par('"',',',threads);
+  virtual_count_builder cnt1;
+  t0=now();
+  par(cnt1,input.data(),input.size());
+  const double t2=now()-t0;
+
+  std::vector<virtual_count_builder> cnts(4*threads);
+  std::vector<csv_builder *> outs;
+  for (size_t iA=0;iA<cnts.size();iA++) {
+    outs.push_back(&cnts[iA]);
+  }
+  t0=now();
+  par(outs,input.data(),input.size());
+  const double t3=now()-t0;
+  size_t cells=0;
+  for (size_t iA=0;iA<cnts.size();iA++) {
+    cells+=cnts[iA].cnt.cells;
+  }
+
+  printf("{\"bench\":\"parallel\",\"bytes\":%lu,\"threads\":%d,\"identical\":%s,"
+         "\"serial_mb_s\":%.1f,\"ordered_mb_s\":%.1f,\"per_chunk_mb_s\":%.1f}\n",
+         (unsigned long)input.size(),threads,
+         ( (cnt1.cnt.cells==cnt0.cnt.cells)&&(cnt1.cnt.bytes==cnt0.cnt.bytes)&&(cells==cnt0.cnt.cells) ) ? "true" : "false",
+         input.size()/t1/1e6,input.size()/t2/1e6,input.size()/t3/1e6);
+}
+// }}}
+
+// {{{ suite: per corpus shape and stage, best of rounds
+class null_builder : public csv_builder {
+public:
+  void cell(const char *buf,int len) {}
+};
+
+struct stage_result { // {{{
+  stage_result() : secs(1e30),allocs(0),ok(true) {}
+
+  void start() {
+    alloc0=alloc_count;
+    t0=now();
+  }
+  void stop() {
+    const double t=now()-t0;
+    if (t<secs) {
+      secs=t;
+    }
+    allocs=alloc_count-alloc0;
+  }
+
+  void print(const char *shape,const char *stage,const Corpus &corpus,size_t bytes) const {
+    printf("{\"bench\":\"suite\",\"shape\":\"%s\",\"stage\":\"%s\",\"ok\":%s,"
+           "\"bytes\":%lu,\"rows\":%lu,\"cells\":%lu,\"secs\":%.6f,"
+           "\"mb_s\":%.1f,\"rows_s\":%.0f,\"cells_s\":%.0f,\"allocs_per_row\":%.4f}\n",
+           shape,stage,(ok) ? "true" : "false",
+           (unsigned long)bytes,(unsigned long)corpus.rows,(unsigned long)corpus.cells,secs,
+           bytes/secs/1e6,corpus.rows/secs,corpus.cells/secs,(double)allocs/corpus.rows);
+  }
+
+  double secs;
+  size_t allocs;
+  bool ok;
+private:
+  double t0;
+  size_t alloc0;
+};
+// }}}
+
+static void bench_suite(size_t bytes,int rounds) // {{{
+{
+  Corpus corpus;
+  for (int shape=0;shape<NumShapes;shape++) {
+    gen_corpus(corpus,(Shape)shape,bytes);
+    const char *name=shape_names[shape];
+    const std::string &input=corpus.data;
+
+    // csvparser -> null_builder
+    stage_result res;
+    for (int iA=0;iA<rounds;iA++) {
+      null_builder nb;
+      csvparser cp(nb);
+      cp.set_zero_copy(true);
+      res.start();
+      res.ok=(!cp(input))&&(!cp.finish());
+      res.stop();
+    }
+    res.print(name,"parse_null",corpus,input.size());
+
+    // csvparser -> SimpleCSV::builder
+    res=stage_result();
+    for (int iA=0;iA<rounds;iA++) {
+      SimpleCSV::Table tbl;
+      SimpleCSV::builder bld(tbl);
+      csvparser cp(bld);
+      res.start();
+      res.ok=(!cp(input))&&(!cp.finish())&&((size_t)tbl.size()==corpus.rows);
+      res.stop();
+    }
+    res.print(name,"parse_table",corpus,input.size());
+
+    // Table::write -> csv_writer
+    SimpleCSV::Table tbl;
+    {
+      SimpleCSV::builder bld(tbl);
+      csvparser cp(bld);
+      cp(input);
+      cp.finish();
+    }
+    res=stage_result();
+    size_t outsize=0;
+    for (int iA=0;iA<rounds;iA++) {
+      csv_writer<csv_outbuf> wr('"',',',true);
+      res.start();
+      tbl.write(wr);
+      res.stop();
+      outsize=wr.output().size();
+    }
+    res.print(name,"table_write",corpus,outsize);
+
+    // csvparser -> csv_writer; re-emitting that output must give the same bytes
+    res=stage_result();
+    for (int iA=0;iA<rounds;iA++) {
+      csv_writer<csv_outbuf> wr;
+      csvparser cp(wr);
+      cp.set_zero_copy(true);
+      res.start();
+      res.ok=(!cp(input))&&(!cp.finish());
+      res.stop();
+
+      csv_writer<csv_outbuf> wr2;
+      csvparser cp2(wr2);
+      const std::string out(wr.output().data(),wr.output().size());
+      res.ok=(res.ok)&&(!cp2(out))&&(!cp2.finish())&&
+             (out.size()==wr2.output().size())&&(memcmp(out.data(),wr2.output().data(),out.size())==0);
+    }
+    res.print(name,"roundtrip",corpus,input.size());
+  }
+}
+// }}}
+// }}}
+
+// rfc4180 (no trim, crlf): generic csv_runtime_dialect vs. compile-time csv_rfc4180
+// vs. csvparser_dialect (precompiled instance, virtual builder)
+static void bench_dialect(const std::string &input,const char *shape) // {{{
+{
+  count_builder cnt0;
+  basic_csvparser<count_builder> cp0(cnt0);
+  const double t0=parse_input(cp0,input);
+
+  count_builder cnt1;
+  basic_csvparser<count_builder> cp1(cnt1,csv_runtime_dialect('"',',',csv_crlf));
+  const double t1=parse_input(cp1,input);
+
+  count_builder cnt2;
+  basic_csvparser<count_builder,csv_nostats,csv_rfc4180> cp2(cnt2);
+  const double t2=parse_input(cp2,input);
+
+  virtual_count_builder vcnt;
+  csvparser_dialect cp3(vcnt,csv_runtime_dialect('"',',',csv_crlf));
+  const double t3=parse_input(cp3,input);
+
+  printf("{\"bench\":\"dialect\",\"shape\":\"%s\",\"bytes\":%lu,\"identical\":%s,"
+         "\"default_trim_mb_s\":%.1f,\"runtime_rfc_mb_s\":%.1f,\"static_rfc_mb_s\":%.1f,"
+         "\"dispatch_rfc_mb_s\":%.1f}\n",
+         shape,(unsigned long)input.size(),
+         ( (cnt1.cells==cnt2.cells)&&(cnt1.bytes==cnt2.bytes)&&(vcnt.cnt.bytes==cnt2.bytes) ) ? "true" : "false",
+         input.size()/t0/1e6,input.size()/t1/1e6,input.size()/t2/1e6,input.size()/t3/1e6);
+}
+// }}}
+
+class count_errors : public csv_error_handler {
+public:
+  count_errors() : count(0) {}
+  void bad_row(const char *errmsg,size_t begin,size_t end) {
+    count++;
+  }
+  size_t count;
+};
+
+// clean input (strict) vs. one corrupt row in the middle (lenient)
+static void bench_lenient(const std::string &input,int rows) // {{{
+{
+  std::string dirty(input);
+  const size_t mid=dirty.find('\n',dirty.size()/2)+1;
+  dirty.insert(mid,"1,\"x\"y,3\n");
+
+  count_builder cnt1;
+  basic_csvparser<count_builder> cp1(cnt1);
+  const double t1=parse_input(cp1,input);
+
+  count_builder cnt2;
+  count_errors errs;
+  basic_csvparser<count_builder> cp2(cnt2);
+  cp2.set_error_handler(&errs);
+  const double t2=parse_input(cp2,dirty);
+
+  // every 16th row bad, into a Table (dropped rows are popped)
+  std::string many;
+  for (size_t pos=0,line=0;pos<input.size();line++) {
+    size_t next=input.find('\n',pos)+1;
+    if (!next) { // (npos)
+      next=input.size();
+    }
+    many.append(input,pos,next-pos);
+    if (line%16==15) {
+      many+="1,\"x\"y,3\n";
+    }
+    pos=next;
+  }
+  SimpleCSV::Table tbl;
+  SimpleCSV::builder bld(tbl);
+  count_errors errs3;
+  basic_csvparser<csv_builder> cp3(bld);
+  cp3.set_error_handler(&errs3);
+  const double t3=parse_input(cp3,many);
+
+  printf("{\"bench\":\"lenient\",\"rows\":%d,\"good_rows\":%lu,\"bad_rows\":%lu,"
+         "\"strict_clean_mb_s\":%.1f,\"lenient_dirty_mb_s\":%.1f,"
+         "\"table_bad_rows\":%lu,\"table_dirty_mb_s\":%.1f}\n",
+         rows,(unsigned long)cnt2.rows,(unsigned long)errs.count,
+         input.size()/t1/1e6,dirty.size()/t2/1e6,
+         (unsigned long)errs3.count,many.size()/t3/1e6);
+}
+// }}}
+
+// decompress everything, then parse vs. csv_zinput (decompression thread) feeding the parser
+static void bench_zinput(const std::string &input) // {{{
+{
+  z_stream zs;
+  memset(&zs,0,sizeof(zs));
+  deflateInit2(&zs,Z_DEFAULT_COMPRESSION,Z_DEFLATED,15+16,8,Z_DEFAULT_STRATEGY);
+  std::vector<char> gz(deflateBound(&zs,input.size()));
+  zs.next_in=(Bytef *)input.data();
+  zs.avail_in=input.size();
+  zs.next_out=(Bytef *)&gz[0];
+  zs.avail_out=gz.size();
+  deflate(&zs,Z_FINISH);
+  gz.resize(zs.total_out);
+  deflateEnd(&zs);
+
+  const char *fname="bench_csv.csv.gz";
+  FILE *f=fopen(fname,"wb");
+  fwrite(&gz[0],1,gz.size(),f);
+  fclose(f);
+
+  // serial
+  double t0=now();
+  std::string plain(input.size(),'\0');
+  {
+    std::vector<char> raw(gz.size());
+    const int fd=open(fname,O_RDONLY);
+    const ssize_t res=read(fd,&raw[0],raw.size());
+    close(fd);
+    memset(&zs,0,sizeof(zs));
+    inflateInit2(&zs,15+16);
+    zs.next_in=(Bytef *)&raw[0];
+    zs.avail_in=(res>0) ? res : 0;
+    zs.next_out=(Bytef *)&plain[0];
+    zs.avail_out=plain.size();
+    inflate(&zs,Z_FINISH);
+    inflateEnd(&zs);
+  }
+  count_builder cnt1;
+  basic_csvparser<count_builder> cp1(cnt1);
+  cp1(plain);
+  cp1.finish();
+  const double t1=now()-t0;
+
+  // pipelined
+  t0=now();
+  count_builder cnt2;
+  basic_csvparser<count_builder> cp2(cnt2);
+  const int fd=open(fname,O_RDONLY);
+  csv_zinput in;
+  in.open(fd);
+  const char *buf;
+  size_t len;
+  while (in.next(buf,len)) {
+    cp2(buf,len);
+  }
+  cp2.finish();
+  close(fd);
+  const double t2=now()-t0;
+  unlink(fname);
+
+  printf("{\"bench\":\"zinput\",\"bytes\":%lu,\"gz_bytes\":%lu,\"cpus\":%d,\"identical\":%s,"
+         "\"serial_mb_s\":%.1f,\"pipelined_mb_s\":%.1f}\n",
+         (unsigned long)input.size(),(unsigned long)gz.size(),csv_threads(0),
+         ( (!in.error())&&(cnt1.cells==cnt2.cells)&&(cnt1.bytes==cnt2.bytes) ) ? "true" : "false",
+         input.size()/t1/1e6,input.size()/t2/1e6);
+}
+// }}}
+
+// reparsing the csv vs. loading a snapshot (mmap) and touching every cell
+static void bench_snapshot(const std::string &input,int rows) // {{{
+{
+  double t0=now();
+  SimpleCSV::Table tbl;
+  SimpleCSV::builder bld(tbl,true);
+  csvparser cp(bld);
+  cp(input);
+  cp.finish();
+  const double t1=now()-t0;
+
+  const char *fname="bench_csv.snap";
+  t0=now();
+  const bool err=tbl.saveSnapshot(fname);
+  const double t2=now()-t0;
+
+  t0=now();
+  SimpleCSV::Table snap;
+  const bool lerr=SimpleCSV::Table::IBuild::loadSnapshot(snap,fname);
+  const double t3=now()-t0;
+
+  size_t sum=0;
+  for (int iA=0;iA<snap.size();iA++) {
+    const SimpleCSV::Row row=snap[iA];
+    for (int iB=0;iB<row.size();iB++) {
+      sum+=row[iB].asString().size();
+    }
+  }
+  const double t4=now()-t0;
+  unlink(fname);
+
+  printf("{\"bench\":\"snapshot\",\"rows\":%d,\"ok\":%s,\"parse_s\":%.4f,\"save_s\":%.4f,"
+         "\"load_s\":%.6f,\"load_scan_s\":%.4f,\"bytes\":%lu}\n",
+         rows,( (!err)&&(!lerr)&&(snap.size()==tbl.size()) ) ? "true" : "false",
+         t1,t2,t3,t4,(unsigned long)sum);
+}
+// }}}
+
+// csv_writer::cell before it used csv_scanner: byte by byte need_quote and escape loop
+template <typename Output>
+class scalar_writer : public csv_builder { // {{{
+public:
+  scalar_writer(Output out,char qchar='"',char sep=',',bool smart_quote=false)
+    : out(out),
+      qchar(qchar),sep(sep),
+      smart_quote(smart_quote),
+      first(true)
+  {}
+
+  void begin_row() {
+    first=true;
+  }
+  void cell(const char *buf,int len) {
+    if (!first) {
+      out(&sep,1);
+    } else {
+      first=false;
+    }
+    if (!buf) {
+      return;
+    }
+    if ( (smart_quote)&&(!need_quote(buf,len)) ) {
+      out(buf,len);
+    } else {
+      out(&qchar,1);
+
+      const char *pos=buf;
+      while (len>0) {
+        if (*pos==qchar) {
+          out(buf,pos-buf+1); // first qchar
+          buf=pos; // qchar still there! (second one)
+        }
+        pos++;
+        len--;
+      }
+      out(buf,pos-buf);
+
+      out(&qchar,1);
+    }
+  }
+  void end_row() {
+    out("\n",1);
+  }
+
+  Output &output() { return out; }
+private:
+  bool need_quote(const char *buf,int len) const {
+    while (len>0) {
+      if ( (*buf==qchar)||(*buf==sep)||(*buf=='\n') ) {
+        return true;
+      }
+      buf++;
+      len--;
+    }
+    return false;
+  }
+private:
+  Output out;
+  char qchar;
+  char sep;
+  bool smart_quote;
+
+  bool first;
+};
+// }}}
+
+// long text cells, some of them need quoting
+static void gen_text_cells(std::vector<std::string> &ret,int count) // {{{
+{
+  unsigned int seed=54321;
+  for (int iA=0;iA<count;iA++) {
+    seed=seed*1103515245+12345;
+    std::string cell;
+    const int len=20+(seed>>16)%200;
+    for (int iB=0;iB<len;iB++) {
+      seed=seed*1103515245+12345;
+      const unsigned int r=(seed>>16)%1000;
+      cell.push_back( (r==0) ? '"' : (r==1) ? ',' : 'a'+r%26 );
+    }
+    ret.push_back(cell);
+  }
+}
+// }}}
+
+template <typename Writer>
+static double write_cells(Writer &wr,const std::vector<std::string> &cells,int rounds) // {{{
+{
+  const double t0=now();
+  for (int iA=0;iA<rounds;iA++) {
+    wr.output().clear();
+    for (size_t iB=0;iB<cells.size();iB+=10) {
+      wr.begin_row();
+      for (size_t iC=iB;(iC<iB+10)&&(iC<cells.size());iC++) {
+        wr.cell(cells[iC].data(),cells[iC].size());
+      }
+      wr.end_row();
+    }
+  }
+  return now()-t0;
+}
+// }}}
+
+static void bench_writer_quote(int count,int rounds) // {{{
+{
+  std::vector<std::string> cells;
+  gen_text_cells(cells,count);
+
+  for (int smart=0;smart<2;smart++) {
+    csv_outbuf refout;
+    scalar_writer<csv_outbuf &> ref(refout,'"',',',smart);
+    const double tref=write_cells(ref,cells,rounds);
+    const size_t bytes=ref.output().size();
+
+    for (int impl=csv_scanner::Scalar;impl<=csv_scanner::best();impl++) {
+      csv_scanner::use((csv_scanner::Impl)impl);
+      csv_writer<csv_outbuf> wr('"',',',smart);
+      const double t=write_cells(wr,cells,rounds);
+      const bool same=(wr.output().size()==bytes)&&
+                      (memcmp(wr.output().data(),ref.output().data(),bytes)==0);
+
+      static const char *const names[]={"scalar","sse2","avx2"};
+      printf("{\"bench\":\"writer_quote\",\"smart_quote\":%d,\"impl\":\"%s\","
+             "\"bytes\":%lu,\"identical\":%s,"
+             "\"bytewise_mb_s\":%.1f,\"mb_s\":%.1f}\n",
+             smart,names[impl],
+             (unsigned long)bytes,(same) ? "true" : "false",
+             bytes*rounds/tref/1e6,bytes*rounds/t/1e6);
+    }
+    csv_scanner::use(csv_scanner::best());
+  }
+}
+// }}}
+
+// bench_csv [rows [cols [suite_mb]]]; one json object per line
+int main(int argc,char **argv)
+{
+  const int rows=(argc>1) ? atoi(argv[1]) : 200000;
+  const int cols=(argc>2) ? atoi(argv[2]) : 20;
+  const int suite_mb=(argc>3) ? atoi(argv[3]) : 8;
+
+  std::string input;
+  gen_table(input,rows,cols);
+
+  bench_suite((size_t)suite_mb<<20,3);
+
+  bench_table_alloc(input,rows,cols);
+  bench_dispatch(input);
+  bench_stats(input);
+  bench_lenient(input,rows);
+  bench_dialect(input,"table");
+  {
+    Corpus corpus;
+    gen_corpus(corpus,WideText,(size_t)suite_mb<<20);
+    bench_dialect(corpus.data,shape_names[WideText]);
+  }
+  bench_reader(input,rows);
+  bench_projection(rows/10,200);
+  bench_predicate(input,rows);
+  bench_lookup(input,rows,cols);
+  bench_index(input,rows);
+  bench_row_delete(rows);
+  bench_write_parallel(input,rows);
+  bench_parallel(input);
+  bench_snapshot(input,rows);
+  bench_zinput(input);
+  bench_writer_quote(100000,10);
+
+  return 0;
+}
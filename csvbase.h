@@ -1,6 +1,8 @@
 #ifndef _CSVBASE_H
 #define _CSVBASE_H
 
+#include <stddef.h>
+
 class csv_builder { // abstract base
 public:
   virtual ~csv_builder() {}
@@ -8,6 +10,20 @@ public:
   virtual void begin_row() {}
   virtual void cell(const char *buf,int len) =0;  // buf can be NULL
   virtual void end_row() {}
+
+  // lenient parsing: the current row is malformed and dropped; cells delivered so far
+  // must be discarded (the default: nothing to do, for builders that only act in end_row())
+  virtual void abort_row() {}
+};
+
+// lenient parsing (basic_csvparser::set_error_handler): called for each malformed row,
+// after it was skipped up to the next unquoted newline (or end of input)
+class csv_error_handler { // abstract base
+public:
+  virtual ~csv_error_handler() {}
+
+  // [begin,end): byte offsets of the row (incl. its newline) since the start of input
+  virtual void bad_row(const char *errmsg,size_t begin,size_t end) =0;
 };
 
 #endif
@@ -0,0 +1,63 @@
+#ifndef _CSVDFA_H
+#define _CSVDFA_H
+
+// table driven version of csvFSM (csvfsm.cpp): same states, transitions and error messages
+// (used by basic_csvparser, tables in csvparser.cpp)
+namespace csvDFA {
+
+// Byte classes (Events)
+enum Class {
+  Cchar=0, // and fallback
+  Cwhitespace,
+  Cqchar,
+  Csep,
+  Cnewline,
+  Ccr,     // (csv_crlf)
+  NumClasses
+};
+
+// States
+enum State {
+  Start=0,
+  ReadSkipPre,
+  ReadQuoted,
+  ReadQuotedCheckEscape,
+  ReadQuotedSkipPost,
+  ReadUnquoted,
+  ReadUnquotedWhitespace,  // (only differs from ReadUnquoted by its error message)
+  ReadError,
+  SkipRow,        // lenient: after an error, up to the next unquoted newline;
+  SkipRowCellStart, //   a qchar opens a quoted cell only at the start of a cell,
+  SkipRowQuoted,    //   inside a cell it is data (like the one that caused the error)
+  SkipRowQuotedCheckEnd,
+  StartAfterCR,   // (csv_crlf) same as Start, but swallows a '\n'
+  NumStates
+};
+
+// Actions (executed in this order)
+enum Action {
+  Abegin_row=0x01,
+  Aadd=0x02,
+  Acell=0x04,
+  Anull_cell=0x08,
+  Aend_row=0x10,
+  Aerror=0x20,  // exclusive; message by source state
+  Aresync=0x40  // lenient: end of a skipped row
+};
+
+struct Trans {
+  unsigned char next;
+  unsigned char action;
+};
+
+extern const Trans table[NumStates][NumClasses];
+extern const Trans table_quote_in_unquoted[NumStates][NumClasses]; // (csv_quote_in_unquoted)
+extern const char *const errmsgs[NumStates];
+
+// byte -> Class; same precedence as csvFSM: qchar, sep, whitespace, newline
+// flags: csv_dialect_flags
+void init_classes(unsigned char (&cls)[256],char qchar,char sep,int flags);
+
+} // namespace csvDFA
+
+#endif
@@ -0,0 +1,41 @@
+#ifndef _CSVDIALECT_H
+#define _CSVDIALECT_H
+
+// Dialect of basic_csvparser<Builder,Stats,Dialect>: qchar, sep and these flags
+enum csv_dialect_flags {
+  csv_trim=0x01,              // ' ' before / after cells is skipped (trailing: only after quoted)
+  csv_trim_tab=0x02,          // same for '\t' (unless sep)
+  csv_crlf=0x04,              // "\r\n" and a lone '\r' also end rows (otherwise '\r' is data)
+  csv_quote_in_unquoted=0x08  // qchar inside an unquoted cell is data (otherwise error)
+};
+
+// fixed at compile time: the parser's qchar / sep arguments are ignored
+template <char Q,char Sep,int Flags>
+struct csv_dialect {
+  csv_dialect(char qchar=Q,char sep=Sep) {}
+
+  static char qchar() { return Q; }
+  static char sep() { return Sep; }
+  static int flags() { return Flags; }
+};
+
+typedef csv_dialect<'"',',',csv_crlf> csv_rfc4180;
+typedef csv_dialect<'"','\t',csv_crlf> csv_tsv;
+typedef csv_dialect<'"',';',csv_trim|csv_crlf> csv_semicolon;
+
+// chosen at runtime (default of basic_csvparser: csv_trim, i.e. the traditional behavior)
+struct csv_runtime_dialect {
+  csv_runtime_dialect(char qchar='"',char sep=',',int flags=csv_trim)
+    : q(qchar),s(sep),f(flags)
+  {}
+
+  char qchar() const { return q; }
+  char sep() const { return s; }
+  int flags() const { return f; }
+
+private:
+  char q,s;
+  int f;
+};
+
+#endif
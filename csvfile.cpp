@@ -0,0 +1,118 @@
+#include "csvfile.h"
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vector>
+#include "csvparser.h"
+#include "csvzinput.h"
+
+bool csvfile::operator()(const char *filename) // {{{
+{
+  const int fd=open(filename,O_RDONLY);
+  if (fd<0) {
+    errmsg=strerror(errno);
+    return true;
+  }
+  const bool ret=(operator())(fd);
+  close(fd);
+  return ret;
+}
+// }}}
+
+bool csvfile::operator()(int fd) // {{{
+{
+  struct stat st;
+  if (fstat(fd,&st)<0) {
+    errmsg=strerror(errno);
+    return true;
+  }
+  if ( (S_ISREG(st.st_mode))&&(st.st_size>0) ) {
+    unsigned char magic[4];
+    const ssize_t res=pread(fd,magic,sizeof(magic),0);
+    if ( (res>0)&&(csv_zinput::detect(magic,res)==csv_zinput::Plain) ) {
+      return parse_mmap(fd,st.st_size);
+    }
+  }
+  return parse_stream(fd);
+}
+// }}}
+
+bool csvfile::parse_mmap(int fd,size_t size) // {{{
+{
+  void *map=mmap(NULL,size,PROT_READ,MAP_PRIVATE,fd,0);
+  if (map==MAP_FAILED) {
+    return parse_stream(fd);
+  }
+  madvise(map,size,MADV_SEQUENTIAL);
+
+  // page aligned, and must fit parser's int len
+  const size_t pagesize=sysconf(_SC_PAGESIZE);
+  size_t win=(window/pagesize)*pagesize;
+  if (win==0) {
+    win=pagesize;
+  } else if (win>(1u<<30)) {
+    win=1u<<30;
+  }
+
+  const char *base=(const char *)map;
+  bool ret=false;
+  for (size_t off=0;off<size;off+=win) {
+    const size_t len=(size-off<win) ? size-off : win;
+    if (off+len<size) { // readahead next window
+      const size_t next=(size-off-len<win) ? size-off-len : win;
+      madvise((char *)base+off+len,next,MADV_WILLNEED);
+    }
+
+    const char *buf=base+off;
+    if (parser(buf,len)) {
+      errmsg=parser.error();
+      ret=true;
+      break;
+    }
+    // done with this window: don't keep it resident
+    madvise((char *)base+off,len,MADV_DONTNEED);
+  }
+  if ( (!ret)&&(parser.finish()) ) {
+    errmsg=parser.error();
+    ret=true;
+  }
+
+  munmap(map,size);
+  return ret;
+}
+// }}}
+
+bool csvfile::parse_stream(int fd) // {{{
+{
+  // (must fit parser's int len)
+  const size_t bufsize=(window<1024*1024) ? window : 1024*1024;
+  csv_zinput in(bufsize);
+  if (in.open(fd)) {
+    errmsg=strerror(errno);
+    return true;
+  }
+  const char *buf;
+  size_t len;
+  while (in.next(buf,len)) {
+    if (parser(buf,len)) {
+      errmsg=parser.error();
+      return true;
+    }
+  }
+  if (in.error()) {
+    errbuf=in.error();
+    errmsg=errbuf.c_str();
+    return true;
+  }
+  if (parser.finish()) {
+    errmsg=parser.error();
+    return true;
+  }
+  return false;
+}
+// }}}
+
@@ -0,0 +1,35 @@
+#ifndef _CSVFILE_H
+#define _CSVFILE_H
+
+#include <stddef.h>
+#include <string>
+
+struct csvparser;  // csvparser.h
+struct csvfile {
+  // window: bytes per parser call (and readahead granularity)
+  csvfile(csvparser &parser,size_t window=16*1024*1024)
+    : parser(parser),
+      window(window),
+      errmsg(NULL)
+  {}
+
+  // regular files are mmap'ed; compressed files (gzip, zstd: see csv_zinput), pipes etc.
+  // are read and decompressed by a second thread, overlapped with parsing;
+  // parser.finish() is called at end of input
+  // NOTE: returns true on error
+  bool operator()(const char *filename);
+  bool operator()(int fd);
+
+  const char *error() const { return errmsg; }
+
+private:
+  bool parse_mmap(int fd,size_t size);
+  bool parse_stream(int fd);
+private:
+  csvparser &parser;
+  size_t window;
+  const char *errmsg;
+  std::string errbuf;
+};
+
+#endif
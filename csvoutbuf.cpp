@@ -0,0 +1,131 @@
+#include "csvoutbuf.h"
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+csv_outbuf::csv_outbuf(size_t blocksize) // {{{
+  : fd(-1),f(NULL),
+    blocksize(blocksize),
+    used(0),marked(0),
+    is_marked(false),
+    err(false)
+{
+}
+// }}}
+
+csv_outbuf::csv_outbuf(int fd,size_t blocksize) // {{{
+  : fd(fd),f(NULL),
+    blocksize(blocksize),
+    used(0),marked(0),
+    is_marked(false),
+    err(false)
+{
+}
+// }}}
+
+csv_outbuf::csv_outbuf(FILE *f,size_t blocksize) // {{{
+  : fd(-1),f(f),
+    blocksize(blocksize),
+    used(0),marked(0),
+    is_marked(false),
+    err(false)
+{
+}
+// }}}
+
+void csv_outbuf::overflow(const char *buf,size_t len) // {{{
+{
+  if ( (fd<0)&&(!f) ) { // memory: grow
+    size_t newsize=(buffer.empty()) ? blocksize : 2*buffer.size();
+    if (newsize<used+len) {
+      newsize=used+len;
+    }
+    buffer.resize(newsize);
+  } else if ( (len>=blocksize/2)&&(!is_marked) ) { // large: no copy
+    write_out(buffer.data(),used,buf,len);
+    used=0;
+    return;
+  } else {
+    if (buffer.size()<blocksize) { // (first use)
+      buffer.resize(blocksize);
+    }
+    if (len>buffer.size()-used) { // (keeps the marked part)
+      const size_t done=(is_marked) ? marked : used;
+      write_out(buffer.data(),done,NULL,0);
+      memmove(buffer.data(),buffer.data()+done,used-done);
+      used-=done;
+      marked=0;
+      if (len>buffer.size()-used) {
+        buffer.resize(used+len);
+      }
+    }
+  }
+  memcpy(buffer.data()+used,buf,len);
+  used+=len;
+}
+// }}}
+
+bool csv_outbuf::write_out(const char *buf1,size_t len1,const char *buf2,size_t len2) // {{{
+{
+  if (err) {
+    return false;
+  }
+  if (f) {
+    if ( (fwrite(buf1,1,len1,f)!=len1)||
+         (fwrite(buf2,1,len2,f)!=len2) ) {
+      err=true;
+    }
+    return !err;
+  }
+  struct iovec iov[2];
+  iov[0].iov_base=(void *)buf1;
+  iov[0].iov_len=len1;
+  iov[1].iov_base=(void *)buf2;
+  iov[1].iov_len=len2;
+  int iovcnt=2;
+  struct iovec *pos=iov;
+  while ( (iovcnt>0)&&(pos[0].iov_len==0) ) {
+    pos++;
+    iovcnt--;
+  }
+  while (iovcnt>0) {
+    ssize_t res=writev(fd,pos,iovcnt);
+    if (res<0) {
+      if (errno==EINTR) {
+        continue;
+      }
+      err=true;
+      return false;
+    }
+    // partial write
+    while ( (iovcnt>0)&&((size_t)res>=pos[0].iov_len) ) {
+      res-=pos[0].iov_len;
+      pos++;
+      iovcnt--;
+    }
+    if (iovcnt>0) {
+      pos[0].iov_base=(char *)pos[0].iov_base+res;
+      pos[0].iov_len-=res;
+    }
+  }
+  return true;
+}
+// }}}
+
+bool csv_outbuf::flush() // {{{
+{
+  if ( (fd<0)&&(!f) ) { // memory
+    return err;
+  }
+  if (used) {
+    write_out(buffer.data(),used,NULL,0);
+    used=marked=0;
+    is_marked=false;
+  }
+  if ( (f)&&(fflush(f)!=0) ) {
+    err=true;
+  }
+  return err;
+}
+// }}}
+
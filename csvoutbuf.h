@@ -0,0 +1,69 @@
+#ifndef _CSVOUTBUF_H
+#define _CSVOUTBUF_H
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+// Buffered Output for csv_writer: appends are inlined, data is written
+// in blocks of blocksize to an fd or FILE*; memory mode just grows.
+// Large appends (>= blocksize/2) go out directly (writev for fds).
+// Not copyable: csv_writer<csv_outbuf> owns one (memory mode),
+// csv_writer<csv_outbuf &> writes to an existing one.
+class csv_outbuf { // {{{
+  csv_outbuf(const csv_outbuf &); // = delete
+  csv_outbuf &operator=(const csv_outbuf &);
+public:
+  explicit csv_outbuf(size_t blocksize=256*1024); // memory
+  explicit csv_outbuf(int fd,size_t blocksize=256*1024);
+  explicit csv_outbuf(FILE *f,size_t blocksize=256*1024);
+  ~csv_outbuf() { flush(); }
+
+  void operator()(const char *buf,int len) {
+    if (len<=0) { // (e.g. empty cell; buffer may still be empty, i.e. data()==NULL)
+      return;
+    } else if ((size_t)len<=buffer.size()-used) {
+      memcpy(buffer.data()+used,buf,len);
+      used+=len;
+    } else {
+      overflow(buf,len);
+    }
+  }
+
+  // NOTE: returns true on error (also for earlier, failed writes)
+  bool flush();
+  bool failed() const { return err; }
+
+  // memory mode: everything written so far; otherwise: not yet flushed part
+  const char *data() const { return (used) ? buffer.data() : ""; }
+  size_t size() const { return used; }
+  void clear() { used=marked=0; is_marked=false; }
+
+  // data appended after mark() stays in the buffer (which grows, if needed)
+  // until the next mark(), flush() or rewind(); rewind() drops it again
+  void mark() { marked=used; is_marked=true; }
+  void rewind() { used=marked; is_marked=false; }
+
+private:
+  void overflow(const char *buf,size_t len);
+  bool write_out(const char *buf1,size_t len1,const char *buf2,size_t len2);
+private:
+  int fd;
+  FILE *f;
+  size_t blocksize;
+  std::vector<char> buffer;
+  size_t used;
+  size_t marked;  // (<=used)
+  bool is_marked;
+  bool err;
+};
+// }}}
+
+// csv_writer: its rows are retracted with rewind() (lenient parsing, csv_builder::abort_row)
+template <typename Output> struct csv_output_rewindable;
+template <>
+struct csv_output_rewindable<csv_outbuf> { static const bool value=true; };
+template <>
+struct csv_output_rewindable<csv_outbuf &> { static const bool value=true; };
+
+#endif
@@ -0,0 +1,349 @@
+#include "csvparallel.h"
+#include <pthread.h>
+#include <unistd.h>
+#include <string>
+#include "csvbase.h"
+#include "csvparser.h"
+#include "csvthreads.h"
+
+static const size_t chunk_size=4*1024*1024;
+static const size_t max_parse_len=1u<<30; // per csvparser call (int len)
+
+namespace {
+
+// records the rows of one chunk, for later replay
+class chunk_recorder : public csv_builder { // {{{
+public:
+  chunk_recorder() : lo(NULL),hi(NULL) {}
+
+  void set_range(const char *begin,const char *end) {
+    lo=begin;
+    hi=end;
+  }
+
+  void cell(const char *buf,int len) {
+    Cell c;
+    if (!buf) {
+      c.buf=NULL;
+      c.len=-1;
+      c.off=0;
+    } else if ( (buf>=lo)&&(buf+len<=hi) ) { // zero-copy: points into input
+      c.buf=buf;
+      c.len=len;
+      c.off=0;
+    } else { // parser scratch (e.g. unescaped)
+      c.buf=NULL;
+      c.len=len;
+      c.off=data.size();
+      data.append(buf,len);
+    }
+    cells.push_back(c);
+  }
+  void end_row() {
+    row_ends.push_back(cells.size());
+  }
+
+  void replay(csv_builder &out) const {
+    size_t cidx=0;
+    for (size_t iA=0;iA<row_ends.size();iA++) {
+      out.begin_row();
+      for (;cidx<row_ends[iA];cidx++) {
+        const Cell &c=cells[cidx];
+        if (c.buf) {
+          out.cell(c.buf,c.len);
+        } else if (c.len<0) {
+          out.cell(NULL,0);
+        } else {
+          out.cell(data.data()+c.off,c.len);
+        }
+      }
+      out.end_row();
+    }
+  }
+
+  void release() {
+    std::vector<Cell>().swap(cells);
+    std::vector<size_t>().swap(row_ends);
+    std::string().swap(data);
+  }
+
+private:
+  struct Cell {
+    const char *buf; // NULL: len<0 ? NULL cell : data+off
+    int len;
+    int off;
+  };
+  const char *lo,*hi;
+  std::vector<Cell> cells;
+  std::vector<size_t> row_ends;
+  std::string data;
+};
+// }}}
+
+} // namespace
+
+struct csvparallel::Job {
+  Job(const csvparallel &self,const char *buf,size_t len)
+    : self(self),buf(buf),len(len),
+      step(chunk_size),
+      outs(NULL),
+      next(0),replayed(0),lookahead(0),
+      abort(false)
+  {
+    pthread_mutex_init(&mutex,NULL);
+    pthread_cond_init(&cond,NULL);
+  }
+  ~Job() {
+    pthread_cond_destroy(&cond);
+    pthread_mutex_destroy(&mutex);
+  }
+
+  int nchunks() const { return bounds.size()-1; }
+
+  static void count_task(void *ctx,int idx);
+  static void parse_task(void *ctx,int idx);
+  static void *ordered_worker(void *arg);
+
+  template <typename Builder>
+  const char *parse_chunk(Builder &out,int idx,bool zero_copy) const;
+
+  const csvparallel &self;
+  const char *buf;
+  size_t len;
+
+  std::vector<size_t> bounds;      // chunk idx: [bounds[idx],bounds[idx+1])
+  size_t step;                     // split(): raw chunk size
+  std::vector<size_t> quotes;      // split(): qchars per raw chunk
+  std::vector<const char *> errs;  // per chunk
+
+  // per-builder mode
+  const std::vector<csv_builder *> *outs;
+
+  // ordered mode
+  std::vector<chunk_recorder> recs;
+  std::vector<char> done;
+  int next,replayed,lookahead;
+  bool abort;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+};
+
+csvparallel::csvparallel(char qchar,char sep,int threads) // {{{
+  : qchar(qchar),sep(sep),
+    threads(threads),
+    errmsg(NULL)
+{
+  this->threads=csv_threads(threads);
+}
+// }}}
+
+void csvparallel::Job::count_task(void *ctx,int idx) // {{{
+{
+  Job &job=*(Job *)ctx;
+  const char qchar=job.self.qchar;
+  const size_t start=idx*job.step;
+  const size_t end=(start+job.step<job.len) ? start+job.step : job.len;
+  size_t count=0;
+  for (size_t iA=start;iA<end;iA++) {
+    count+=(job.buf[iA]==qchar);
+  }
+  job.quotes[idx]=count;
+}
+// }}}
+
+// Chunks must start at a row start, i.e. after a newline outside of quotes.
+// Whether a position is inside quotes follows from the parity of the qchars before it,
+// as long as the input up to there is valid (qchars only enclose cells or are doubled);
+// otherwise the parser reports an error in (or before) that chunk.
+void csvparallel::split(Job &job,int nchunks) const // {{{
+{
+  // count qchars per raw chunk
+  job.step=(job.len+nchunks-1)/nchunks;
+  job.quotes.resize(nchunks);
+  csv_parallel_for pf(&Job::count_task,&job,nchunks);
+  pf.run(threads);
+
+  job.bounds.resize(nchunks+1);
+  job.bounds[0]=0;
+  bool inquote=false;
+  for (int iA=1;iA<nchunks;iA++) {
+    if (job.quotes[iA-1]&1) {
+      inquote=!inquote;
+    }
+    size_t pos=iA*job.step;
+    if (pos>=job.len) {
+      pos=job.len;
+    }
+    if (pos<=job.bounds[iA-1]) { // previous row start already beyond raw start
+      job.bounds[iA]=job.bounds[iA-1];
+      continue;
+    }
+    if ( (job.buf[pos-1]=='\n')&&(!inquote) ) { // exactly at row start
+      job.bounds[iA]=pos;
+      continue;
+    }
+    bool inq=inquote;
+    for (;pos<job.len;pos++) {
+      if (job.buf[pos]==qchar) {
+        inq=!inq;
+      } else if ( (job.buf[pos]=='\n')&&(!inq) ) {
+        pos++;
+        break;
+      }
+    }
+    job.bounds[iA]=pos;
+  }
+  job.bounds[nchunks]=job.len;
+  job.errs.assign(nchunks,(const char *)NULL);
+}
+// }}}
+
+template <typename Builder>
+const char *csvparallel::Job::parse_chunk(Builder &out,int idx,bool zero_copy) const // {{{
+{
+  basic_csvparser<Builder> cp(out,self.qchar,self.sep);
+  cp.set_zero_copy(zero_copy);
+  const char *pos=buf+bounds[idx],*end=buf+bounds[idx+1];
+  while (pos<end) {
+    const size_t plen=(end-pos<(ptrdiff_t)max_parse_len) ? end-pos : max_parse_len;
+    if (cp(pos,plen)) {
+      return cp.error();
+    }
+  }
+  // an unterminated last row can extend over later split points (then empty chunks
+  // follow, their finish() does nothing); all other chunks end at a row start
+  if ( (bounds[idx+1]==len)&&(cp.finish()) ) {
+    return cp.error();
+  }
+  return NULL;
+}
+// }}}
+
+void csvparallel::Job::parse_task(void *ctx,int idx) // {{{
+{
+  Job &job=*(Job *)ctx;
+  job.errs[idx]=job.parse_chunk(*(*job.outs)[idx],idx,false);
+}
+// }}}
+
+void *csvparallel::Job::ordered_worker(void *arg) // {{{
+{
+  Job &job=*(Job *)arg;
+  pthread_mutex_lock(&job.mutex);
+  while (1) {
+    // limit memory used by recorded, not yet replayed chunks
+    while ( (!job.abort)&&(job.next<job.nchunks())&&(job.next>=job.replayed+job.lookahead) ) {
+      pthread_cond_wait(&job.cond,&job.mutex);
+    }
+    if ( (job.abort)||(job.next>=job.nchunks()) ) {
+      break;
+    }
+    const int idx=job.next++;
+    pthread_mutex_unlock(&job.mutex);
+
+    chunk_recorder &rec=job.recs[idx];
+    rec.set_range(job.buf+job.bounds[idx],job.buf+job.bounds[idx+1]);
+    const char *err=job.parse_chunk(rec,idx,true);
+
+    pthread_mutex_lock(&job.mutex);
+    job.errs[idx]=err;
+    job.done[idx]=1;
+    pthread_cond_broadcast(&job.cond);
+  }
+  pthread_mutex_unlock(&job.mutex);
+  return NULL;
+}
+// }}}
+
+bool csvparallel::operator()(csv_builder &out,const char *buf,size_t len) // {{{
+{
+  errmsg=NULL;
+  const size_t nchunks0=(len+chunk_size-1)/chunk_size;
+  const int nchunks=(nchunks0<(1u<<30)) ? nchunks0 : (1u<<30);
+  Job job(*this,buf,len);
+  if ( (threads<=1)||(nchunks<=1) ) {
+    job.bounds.push_back(0);
+    job.bounds.push_back(len);
+    errmsg=job.parse_chunk(out,0,false);
+    return (errmsg!=NULL);
+  }
+
+  split(job,nchunks);
+  job.recs.resize(nchunks);
+  job.done.assign(nchunks,0);
+  job.lookahead=2*threads;
+
+  std::vector<pthread_t> tids;
+  tids.reserve(threads);
+  for (int iA=0;iA<threads;iA++) {
+    pthread_t tid;
+    if (pthread_create(&tid,NULL,&Job::ordered_worker,&job)!=0) {
+      break;
+    }
+    tids.push_back(tid);
+  }
+  int iA;
+  for (iA=0;(iA<nchunks)&&(!tids.empty());iA++) { // (no threads at all: serial fallback below)
+    pthread_mutex_lock(&job.mutex);
+    while (!job.done[iA]) {
+      pthread_cond_wait(&job.cond,&job.mutex);
+    }
+    pthread_mutex_unlock(&job.mutex);
+    if (job.errs[iA]) {
+      break;
+    }
+
+    job.recs[iA].replay(out);
+    job.recs[iA].release();
+
+    pthread_mutex_lock(&job.mutex);
+    job.replayed=iA+1;
+    pthread_cond_broadcast(&job.cond);
+    pthread_mutex_unlock(&job.mutex);
+  }
+
+  pthread_mutex_lock(&job.mutex);
+  job.abort=true;
+  pthread_cond_broadcast(&job.cond);
+  pthread_mutex_unlock(&job.mutex);
+  for (int iB=0;iB<(int)tids.size();iB++) {
+    pthread_join(tids[iB],NULL);
+  }
+
+  if (iA<nchunks) {
+    // chunk iA starts at a real row start (all chunks before were valid);
+    // continue serially to get the exact same output and error as csvparser
+    job.bounds[iA+1]=len;
+    job.bounds.resize(iA+2);
+    errmsg=job.parse_chunk(out,iA,false);
+    return (errmsg!=NULL);
+  }
+  return false;
+}
+// }}}
+
+bool csvparallel::operator()(const std::vector<csv_builder *> &outs,const char *buf,size_t len) // {{{
+{
+  errmsg=NULL;
+  const int nchunks=outs.size();
+  if (nchunks==0) {
+    return false;
+  }
+
+  Job job(*this,buf,len);
+  split(job,nchunks);
+  job.outs=&outs;
+
+  csv_parallel_for pf(&Job::parse_task,&job,nchunks);
+  pf.run(threads);
+
+  for (int iA=0;iA<nchunks;iA++) {
+    if (job.errs[iA]) {
+      errmsg=job.errs[iA];
+      return true;
+    }
+  }
+  return false;
+}
+// }}}
+
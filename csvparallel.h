@@ -0,0 +1,35 @@
+#ifndef _CSVPARALLEL_H
+#define _CSVPARALLEL_H
+
+#include <stddef.h>
+#include <vector>
+
+class csv_builder;  // csvbase.h
+struct csvparallel {
+  // threads==0: number of online cpus
+  csvparallel(char qchar='"',char sep=',',int threads=0);
+
+  // buf is the complete input (e.g. mmap'ed file). It is split into chunks at row
+  // boundaries (determined by quote parity), which are parsed on a thread pool.
+  // NOTE: returns true on error
+
+  // rows are delivered to out in original order (from the calling thread);
+  // output (also on error) is identical to a single csvparser
+  bool operator()(csv_builder &out,const char *buf,size_t len);
+
+  // rows of chunk i are delivered to *outs[i] (from worker threads), for callers that merge
+  bool operator()(const std::vector<csv_builder *> &outs,const char *buf,size_t len);
+
+  const char *error() const { return errmsg; }
+
+private:
+  struct Job;  // csvparallel.cpp
+  void split(Job &job,int nchunks) const;
+private:
+  char qchar;
+  char sep;
+  int threads;
+  const char *errmsg;
+};
+
+#endif
@@ -1,209 +1,225 @@
 #include "csvparser.h"
-#include <assert.h>
 #include <string.h>
-#include "csvbase.h"
 
-#include <boost/variant.hpp>
-
-//#define DEBUG
-
-#ifdef DEBUG
-  #include <stdio.h>
-  #include <typeinfo>
-#endif
-
-namespace csvFSM {
-
-// States
-struct Start {};
-struct ReadSkipPre {};
-struct ReadQuoted {};
-struct ReadQuotedCheckEscape {};
-struct ReadQuotedSkipPost {};
-struct ReadUnquoted {};
-struct ReadUnquotedWhitespace { 
-  ReadUnquotedWhitespace(unsigned char value) : value(1,value) {}
-  std::string value;
-};
-struct ReadError {
-  ReadError(const char *type) : type(type) {} // i.e. for static strings
-  const char *type;
-};
-typedef boost::variant<Start,
-                       ReadSkipPre,
-                       ReadQuoted,
-                       ReadQuotedCheckEscape,
-                       ReadQuotedSkipPost,
-                       ReadUnquoted,
-                       ReadUnquotedWhitespace,
-                       ReadError> States;
-
-// Events
-struct Echar { // and fallback
-  Echar(unsigned char value) : value(value) {}
-  unsigned char value;
-};
-struct Ewhitespace : Echar { 
-  Ewhitespace(unsigned char value) : Echar(value) {}
+namespace csvDFA {
+
+#define T(Snew,action) { Snew, action }
+#define TERR           { ReadError, Aerror }
+// rows shared by both tables
+#define ROW_START(after_nl) { \
+    /* Cchar       */ T(ReadUnquoted, Abegin_row|Aadd), \
+    /* Cwhitespace */ T(ReadSkipPre,  Abegin_row), \
+    /* Cqchar      */ T(ReadQuoted,   Abegin_row), \
+    /* Csep        */ T(ReadSkipPre,  Abegin_row|Anull_cell), \
+    /* Cnewline    */ after_nl, \
+    /* Ccr         */ T(StartAfterCR, Abegin_row|Aend_row) \
+  }
+#define ROWS_START_TO_QUOTED \
+  /* Start */ ROW_START(T(Start, Abegin_row|Aend_row)), \
+  { /* ReadSkipPre */ \
+    /* Cchar       */ T(ReadUnquoted, Aadd), \
+    /* Cwhitespace */ T(ReadSkipPre,  0), \
+    /* Cqchar      */ T(ReadQuoted,   0), \
+    /* Csep        */ T(ReadSkipPre,  Anull_cell), \
+    /* Cnewline    */ T(Start,        Anull_cell|Aend_row), \
+    /* Ccr         */ T(StartAfterCR, Anull_cell|Aend_row) \
+  }, \
+  { /* ReadQuoted */ \
+    /* Cchar       */ T(ReadQuoted,            Aadd), \
+    /* Cwhitespace */ T(ReadQuoted,            Aadd), \
+    /* Cqchar      */ T(ReadQuotedCheckEscape, 0), \
+    /* Csep        */ T(ReadQuoted,            Aadd), \
+    /* Cnewline    */ T(ReadQuoted,            Aadd), \
+    /* Ccr         */ T(ReadQuoted,            Aadd) \
+  }, \
+  { /* ReadQuotedCheckEscape */ \
+    /* Cchar       */ TERR, \
+    /* Cwhitespace */ T(ReadQuotedSkipPost, 0), \
+    /* Cqchar      */ T(ReadQuoted,         Aadd), \
+    /* Csep        */ T(ReadSkipPre,        Acell), \
+    /* Cnewline    */ T(Start,              Acell|Aend_row), \
+    /* Ccr         */ T(StartAfterCR,       Acell|Aend_row) \
+  }, \
+  { /* ReadQuotedSkipPost */ \
+    /* Cchar       */ TERR, \
+    /* Cwhitespace */ T(ReadQuotedSkipPost, 0), \
+    /* Cqchar      */ TERR, \
+    /* Csep        */ T(ReadSkipPre,        Acell), \
+    /* Cnewline    */ T(Start,              Acell|Aend_row), \
+    /* Ccr         */ T(StartAfterCR,       Acell|Aend_row) \
+  }
+#define ROW_UNQUOTED(on_qchar) { \
+    /* Cchar       */ T(ReadUnquoted,           Aadd), \
+    /* Cwhitespace */ T(ReadUnquotedWhitespace, Aadd), \
+    /* Cqchar      */ on_qchar, \
+    /* Csep        */ T(ReadSkipPre,            Acell), \
+    /* Cnewline    */ T(Start,                  Acell|Aend_row), \
+    /* Ccr         */ T(StartAfterCR,           Acell|Aend_row) \
+  }
+#define ROWS_ERROR_TO_END \
+  { /* ReadError */ \
+    TERR, TERR, TERR, TERR, TERR, TERR \
+  }, \
+  { /* SkipRow */ \
+    /* Cchar       */ T(SkipRow,          0), \
+    /* Cwhitespace */ T(SkipRow,          0), \
+    /* Cqchar      */ T(SkipRow,          0), \
+    /* Csep        */ T(SkipRowCellStart, 0), \
+    /* Cnewline    */ T(Start,            Aresync), \
+    /* Ccr         */ T(StartAfterCR,     Aresync) \
+  }, \
+  { /* SkipRowCellStart */ \
+    /* Cchar       */ T(SkipRow,          0), \
+    /* Cwhitespace */ T(SkipRowCellStart, 0), \
+    /* Cqchar      */ T(SkipRowQuoted,    0), \
+    /* Csep        */ T(SkipRowCellStart, 0), \
+    /* Cnewline    */ T(Start,            Aresync), \
+    /* Ccr         */ T(StartAfterCR,     Aresync) \
+  }, \
+  { /* SkipRowQuoted */ \
+    /* Cchar       */ T(SkipRowQuoted,         0), \
+    /* Cwhitespace */ T(SkipRowQuoted,         0), \
+    /* Cqchar      */ T(SkipRowQuotedCheckEnd, 0), \
+    /* Csep        */ T(SkipRowQuoted,         0), \
+    /* Cnewline    */ T(SkipRowQuoted,         0), \
+    /* Ccr         */ T(SkipRowQuoted,         0) \
+  }, \
+  { /* SkipRowQuotedCheckEnd */ \
+    /* Cchar       */ T(SkipRow,          0), \
+    /* Cwhitespace */ T(SkipRow,          0), \
+    /* Cqchar      */ T(SkipRowQuoted,    0), \
+    /* Csep        */ T(SkipRowCellStart, 0), \
+    /* Cnewline    */ T(Start,            Aresync), \
+    /* Ccr         */ T(StartAfterCR,     Aresync) \
+  }, \
+  /* StartAfterCR */ ROW_START(T(Start, 0))
+
+const Trans table[NumStates][NumClasses]={
+  ROWS_START_TO_QUOTED,
+  /* ReadUnquoted */           ROW_UNQUOTED(TERR),
+  /* ReadUnquotedWhitespace */ ROW_UNQUOTED(TERR),
+  ROWS_ERROR_TO_END
 };
-struct Eqchar : Echar {
-  Eqchar(unsigned char value) : Echar(value) {}
+
+const Trans table_quote_in_unquoted[NumStates][NumClasses]={
+  ROWS_START_TO_QUOTED,
+  /* ReadUnquoted */           ROW_UNQUOTED(T(ReadUnquoted, Aadd)),
+  /* ReadUnquotedWhitespace */ ROW_UNQUOTED(T(ReadUnquoted, Aadd)),
+  ROWS_ERROR_TO_END
 };
-struct Esep : Echar {
-  Esep(unsigned char value) : Echar(value) {}
+#undef ROWS_ERROR_TO_END
+#undef ROW_UNQUOTED
+#undef ROWS_START_TO_QUOTED
+#undef ROW_START
+#undef TERR
+#undef T
+
+const char *const errmsgs[NumStates]={
+  NULL, NULL, NULL,
+  "char after possible endquote",            // ReadQuotedCheckEscape
+  "char after endquote",                     // ReadQuotedSkipPost
+  "unexpected quote in unquoted string",     // ReadUnquoted
+  "unexpected quote after unquoted string",  // ReadUnquotedWhitespace
+  NULL, NULL, NULL, NULL, NULL, NULL
 };
-struct Enewline : Echar {
-  Enewline(unsigned char value) : Echar(value) {}
+
+void init_classes(unsigned char (&cls)[256],char qchar,char sep,int flags) // {{{
+{
+  memset(cls,Cchar,sizeof(cls));
+  cls['\n']=Cnewline;
+  if (flags&csv_crlf) {
+    cls['\r']=Ccr;
+  }
+  if (flags&csv_trim) {
+    cls[' ']=Cwhitespace;
+  }
+  if (flags&csv_trim_tab) {
+    cls['\t']=Cwhitespace; // (unless sep, below)
+  }
+  cls[(unsigned char)sep]=Csep;
+  cls[(unsigned char)qchar]=Cqchar;
+}
+// }}}
+
+} // namespace csvDFA
+
+// the virtual csv_builder variant, compiled once
+template class basic_csvparser<csv_builder>;
+
+struct csvparser_dialect::Impl { // {{{
+  virtual ~Impl() {}
+  virtual bool parse(const char *&buf,int len) =0;
+  virtual bool finish() =0;
+  virtual void reset() =0;
+  virtual void set_zero_copy(bool zc) =0;
+  virtual void set_projection(const csv_projection *proj) =0;
+  virtual void set_error_handler(csv_error_handler *eh) =0;
+  virtual const char *error() const =0;
+  bool precompiled;
 };
+// }}}
 
-#define TTS(S,E,Snew,code) bool on(States &self,S &s,const E &e) { code; self=Snew; return true; }
-struct Trans {
-  Trans(csv_builder &out) : out(out) {}
-
-  /*  Start  eps  { begin_row }  ReadSkipPre */
-  TTS(Start, Eqchar,      ReadQuoted(),   { out.begin_row(); });
-  TTS(Start, Esep,        ReadSkipPre(),  { out.begin_row(); next_cell(false); });
-  TTS(Start, Enewline,    self,           { out.begin_row(); out.end_row(); });
-  TTS(Start, Ewhitespace, ReadSkipPre(),  { out.begin_row(); });
-  TTS(Start, Echar,       ReadUnquoted(), { out.begin_row(); add(e); });
-
-  /*
-  template <typename State>
-  TTS(State, Enewline,    Start(), { ("Esep")(); out.end_row(); });  // on(self[_copy],s,Esep(e.value));
-  */
-
-  TTS(ReadSkipPre, Eqchar,      ReadQuoted(),   {});
-  TTS(ReadSkipPre, Esep,        self,           { next_cell(false); });
-  TTS(ReadSkipPre, Enewline,    Start(),        { next_cell(false); out.end_row(); });
-  TTS(ReadSkipPre, Ewhitespace, self,           {});
-  TTS(ReadSkipPre, Echar,       ReadUnquoted(), { add(e); });
-
-  TTS(ReadQuoted, Eqchar,      ReadQuotedCheckEscape(), {});
-  TTS(ReadQuoted, Esep,        self, { add(e); });
-//  TTS(ReadQuoted, Enewline,    self, { add(e); });
-//  TTS(ReadQuoted, Ewhitespace, self, { add(e); });
-  TTS(ReadQuoted, Echar,       self, { add(e); });
-
-  TTS(ReadQuotedCheckEscape, Eqchar,      ReadQuoted(),  { add(e); });
-  TTS(ReadQuotedCheckEscape, Esep,        ReadSkipPre(), { next_cell(); });
-  TTS(ReadQuotedCheckEscape, Enewline,    Start(),       { next_cell(); out.end_row(); });
-  TTS(ReadQuotedCheckEscape, Ewhitespace, ReadQuotedSkipPost(), {});
-  TTS(ReadQuotedCheckEscape, Echar,       ReadError("char after possible endquote"), { return false; });
-
-//  TTS(ReadQuotedSkipPost, Eqchar, ReadError("quote after endquote"),        { return false; });
-  TTS(ReadQuotedSkipPost, Esep,        ReadSkipPre(), { next_cell(); });
-  TTS(ReadQuotedSkipPost, Enewline,    Start(),       { next_cell(); out.end_row(); });
-  TTS(ReadQuotedSkipPost, Ewhitespace, self,          {});
-  TTS(ReadQuotedSkipPost, Echar,       ReadError("char after endquote"),   { return false; });
-
-  TTS(ReadUnquoted, Eqchar,      ReadError("unexpected quote in unquoted string"), { return false; });
-  TTS(ReadUnquoted, Esep,        ReadSkipPre(), { next_cell(); });
-  TTS(ReadUnquoted, Enewline,    Start(),       { next_cell(); out.end_row(); });
-  TTS(ReadUnquoted, Ewhitespace, ReadUnquotedWhitespace(e.value), {});
-  TTS(ReadUnquoted, Echar,       self,          { add(e); });
-
-  TTS(ReadUnquotedWhitespace, Eqchar,      ReadError("unexpected quote after unquoted string"), { return false; });
-  TTS(ReadUnquotedWhitespace, Esep,        ReadSkipPre(),  { cell.append(s.value); next_cell(); });
-  TTS(ReadUnquotedWhitespace, Enewline,    Start(),        { cell.append(s.value); next_cell(); out.end_row(); });
-  TTS(ReadUnquotedWhitespace, Ewhitespace, self,           { s.value.push_back(e.value); });
-  TTS(ReadUnquotedWhitespace, Echar,       ReadUnquoted(), { cell.append(s.value); add(e); });
-
-  TTS(ReadError, Echar, self, { return false; });
-
-private:
-  inline void add(const Echar &e) { cell.push_back(e.value); }
-  inline void next_cell(bool has_content=true) {
-    if (has_content) {
-      out.cell(cell.c_str(),cell.size());
-    } else {
-      assert(cell.empty());
-      out.cell(NULL,0);
-    }
-    cell.clear();
+template <typename Dialect>
+struct csvparser_dialect::ImplT : csvparser_dialect::Impl { // {{{
+  ImplT(csv_builder &out,const Dialect &dialect,bool precompiled)
+    : parser(out,dialect)
+  {
+    this->precompiled=precompiled;
   }
-private:
-  csv_builder &out;
-  std::string cell;
+
+  bool parse(const char *&buf,int len) { return parser(buf,len); }
+  bool finish() { return parser.finish(); }
+  void reset() { parser.reset(); }
+  void set_zero_copy(bool zc) { parser.set_zero_copy(zc); }
+  void set_projection(const csv_projection *proj) { parser.set_projection(proj); }
+  void set_error_handler(csv_error_handler *eh) { parser.set_error_handler(eh); }
+  const char *error() const { return parser.error(); }
+
+  basic_csvparser<csv_builder,csv_nostats,Dialect> parser;
 };
+// }}}
 
-namespace detail {
-  template <class StateVariant,class Event,class Transitions>
-  struct NextState : boost::static_visitor<bool> {
-    NextState(StateVariant &v,const Event &e,Transitions &t) : v(v),e(e),t(t) {}
-
-    template <class State>
-    bool operator()(State &s) const {
-#ifdef DEBUG
-  printf("%s %c\n",typeid(State).name(),e.value);
-#endif
-      return t.on(v,s,e);
-    }
-
-//    bool operator()(...) const { return false; }
-  private:
-    StateVariant &v;
-    const Event &e;
-    Transitions &t;
-  };
-} // namespace detail
-
-#ifdef CPP11
-template <class Transitions=Trans,class StateVariant,class Event>
-bool next(StateVariant &state,Event &&event,Transitions &&trans=Transitions()) {
-  return boost::apply_visitor(detail::NextState<StateVariant,Event,Transitions>(state,std::forward<Event>(event),std::forward<Transitions>(trans)),state);
-}
-#else
-template <class Transitions,class StateVariant,class Event>
-bool next(StateVariant &state,const Event &event,const Transitions &trans=Transitions()) {
-  return boost::apply_visitor(detail::NextState<StateVariant,Event,Transitions>(state,event,trans),state);
-}
-template <class Transitions,class StateVariant,class Event>
-bool next(StateVariant &state,const Event &event,Transitions &trans) {
-  return boost::apply_visitor(detail::NextState<StateVariant,Event,Transitions>(state,event,trans),state);
+template <typename Dialect>
+static bool is_dialect(const csv_runtime_dialect &dialect) // {{{
+{
+  return (dialect.qchar()==Dialect::qchar())&&(dialect.sep()==Dialect::sep())&&
+         (dialect.flags()==Dialect::flags());
 }
-#endif
+// }}}
 
-} // namespace csvFSM
+csvparser_dialect::csvparser_dialect(csv_builder &out,const csv_runtime_dialect &dialect) // {{{
+{
+  if (is_dialect<csv_rfc4180>(dialect)) {
+    impl=new ImplT<csv_rfc4180>(out,csv_rfc4180(),true);
+  } else if (is_dialect<csv_tsv>(dialect)) {
+    impl=new ImplT<csv_tsv>(out,csv_tsv(),true);
+  } else if (is_dialect<csv_semicolon>(dialect)) {
+    impl=new ImplT<csv_semicolon>(out,csv_semicolon(),true);
+  } else {
+    impl=new ImplT<csv_runtime_dialect>(out,dialect,false);
+  }
+}
+// }}}
 
-// TODO?
-bool csvparser::operator()(const std::string &line) // {{{
+csvparser_dialect::~csvparser_dialect() // {{{
 {
-  const char *buf=line.c_str();
-  return (operator())(buf,line.size());
+  delete impl;
 }
 // }}}
 
-bool csvparser::operator()(const char *&buf,int len) // {{{
+bool csvparser_dialect::operator()(const std::string &line) // {{{
 {
-  csvFSM::States state;
-  csvFSM::Trans trans(out);
-  while (len>0) {
-    bool run=true;
-    if (*buf==qchar) {
-      run=csvFSM::next(state,csvFSM::Eqchar(*buf),trans);
-    } else if (*buf==sep) {
-      run=csvFSM::next(state,csvFSM::Esep(*buf),trans);
-    } else if (*buf==' ') { // TODO? more (but DO NOT collide with sep=='\t')
-      run=csvFSM::next(state,csvFSM::Ewhitespace(*buf),trans);
-    } else if (*buf=='\n') {
-      run=csvFSM::next(state,csvFSM::Enewline(*buf),trans);
-    } else {
-      run=csvFSM::next(state,csvFSM::Echar(*buf),trans);
-    }
-    if (!run) {
-      csvFSM::ReadError *err=boost::get<csvFSM::ReadError>(&state);
-      if (err) {
-#ifdef DEBUG
-        fprintf(stderr,"csv parse error: %s\n",err->type);
-#endif
-        errmsg=err->type;
-      }
-      return true;
-    }
-    buf++;
-    len--;
-  }
-  return false;
+  const char *buf=line.c_str();
+  return impl->parse(buf,line.size());
 }
 // }}}
 
+bool csvparser_dialect::operator()(const char *&buf,int len) { return impl->parse(buf,len); }
+bool csvparser_dialect::finish() { return impl->finish(); }
+void csvparser_dialect::reset() { impl->reset(); }
+void csvparser_dialect::set_zero_copy(bool zc) { impl->set_zero_copy(zc); }
+void csvparser_dialect::set_projection(const csv_projection *proj) { impl->set_projection(proj); }
+void csvparser_dialect::set_error_handler(csv_error_handler *eh) { impl->set_error_handler(eh); }
+const char *csvparser_dialect::error() const { return impl->error(); }
+bool csvparser_dialect::precompiled() const { return impl->precompiled; }
+
@@ -2,15 +2,194 @@
 #define _CSVPARSER_H
 
 #include <string>
+#include "csvscan.h"
 
-class csv_builder;  // csvbase.h
-struct csvparser {
+#include <assert.h>
+#include <string.h>
+#include "csvbase.h"
+#include "csvdfa.h"
+#include "csvprojection.h"
+#include "csvstats.h"
+#include "csvdialect.h"
+
+// Builder::abort_row() is optional (also when not derived from csv_builder)
+template <typename Builder>
+struct csv_has_abort_row {
+  struct fallback { void abort_row(); };
+  struct derived : Builder,fallback {};
+  template <typename T,T> struct check;
+  typedef char (&no)[1];
+  typedef char (&yes)[2];
+  template <typename U> static no test(check<void (fallback::*)(),&U::abort_row> *);
+  template <typename U> static yes test(...);  // (ambiguous: Builder has one)
+  static const bool value=(sizeof(test<derived>(0))==sizeof(yes));
+};
+
+template <typename Builder,bool=csv_has_abort_row<Builder>::value>
+struct csv_dispatch_abort_row {
+  static void abort_row(Builder &out) { out.Builder::abort_row(); }
+};
+
+template <typename Builder>
+struct csv_dispatch_abort_row<Builder,false> {
+  static void abort_row(Builder &out) {}
+};
+
+// calls into the builder; qualified (non-virtual, inlinable) for concrete builders
+template <typename Builder>
+struct csv_dispatch : csv_dispatch_abort_row<Builder> {
+  static void begin_row(Builder &out) { out.Builder::begin_row(); }
+  static void cell(Builder &out,const char *buf,int len) { out.Builder::cell(buf,len); }
+  static void end_row(Builder &out) { out.Builder::end_row(); }
+};
+
+template <>
+struct csv_dispatch<csv_builder> { // virtual
+  static void begin_row(csv_builder &out) { out.begin_row(); }
+  static void cell(csv_builder &out,const char *buf,int len) { out.cell(buf,len); }
+  static void end_row(csv_builder &out) { out.end_row(); }
+  static void abort_row(csv_builder &out) { out.abort_row(); }
+};
+
+// Builder: csv_builder interface (need not derive from it); NOTE: its methods are called
+// non-virtually, i.e. an object of a class derived from Builder is used as a Builder
+// Stats: csv_nostats, csv_stats or csv_timed_stats (csvstats.h)
+// Dialect: csv_runtime_dialect, or e.g. csv_rfc4180 (csvdialect.h; qchar / sep are ignored)
+template <typename Builder,typename Stats=csv_nostats,typename Dialect=csv_runtime_dialect>
+class basic_csvparser {
+public:
+  basic_csvparser(Builder &out,char qchar='"',char sep=',');
+  basic_csvparser(Builder &out,const Dialect &dialect);
+
+  // NOTE: returns true on error
+  bool operator()(const std::string &line); // not required to be linewise
+  bool operator()(const char *&buf,int len);  // state (incl. partial cell) is kept across calls
+
+  // end of input: completes a last row without trailing newline
+  bool finish();
+  void reset();  // (also clears error)
+
+  // cells may point directly into the input buffer (not NUL-terminated!);
+  // copied only when unescaping or at chunk boundaries
+  void set_zero_copy(bool zc) { zero_copy=zc; }
+
+  // only cells of these columns are delivered (NULL: all); proj is not copied
+  // and may change between rows (e.g. by the builder, after the header row)
+  void set_projection(const csv_projection *proj) { this->proj=proj; }
+
+  // lenient parsing (NULL: stop at the first error): a malformed row is dropped
+  // (builder: abort_row()), skipped up to the next unquoted newline and reported to eh;
+  // parsing continues with the next row, operator() / finish() do not fail
+  void set_error_handler(csv_error_handler *eh) { on_error=eh; }
+
+  const char *error() const { return errmsg; }
+
+  // (reset() clears them)
+  const Stats &stats() const { return st; }
+
+private:
+  bool parse(const char *&buf,int len);
+  // csv_scanner stops (in ReadUnquoted) at: qchar, sep, this, '\n'
+  char scan_stop() const {
+    return (dialect.flags()&csv_crlf) ? '\r' : (dialect.flags()&csv_trim) ? ' ' : '\n';
+  }
+  // trimmed whitespace the scanner does not stop at (see parse())
+  bool scan_skips_ws() const {
+    const int flags=dialect.flags();
+    return (flags&csv_trim_tab)||( (flags&csv_trim)&&(flags&csv_crlf) );
+  }
+  bool keep_column(int cidx) const { return (!proj)||(proj->keep(cidx)); }
+
+  void begin_row() {
+    st.enter_builder();
+    call::begin_row(out);
+    st.leave_builder();
+  }
+  void emit_cell(const char *buf,int len) {
+    st.enter_builder();
+    call::cell(out,buf,len);
+    st.leave_builder();
+  }
+  void end_row() {
+    st.enter_builder();
+    call::end_row(out);
+    st.leave_builder();
+  }
+  void abort_row() {
+    st.enter_builder();
+    call::abort_row(out);
+    st.leave_builder();
+  }
+  void bad_row(size_t end) {
+    st.bad_row();
+    on_error->bad_row(bad_msg,row_begin,end);
+  }
+
+  typedef csv_dispatch<Builder> call;
+  Builder &out;
+  Dialect dialect;
+  const char *errmsg;
+  bool zero_copy;
+  const csv_projection *proj;
+  csv_error_handler *on_error;
+
+  size_t offset;      // input consumed by previous calls
+  size_t row_begin;   // offset of the current row
+  const char *bad_msg; // (lenient) error of the row being skipped
+
+  int state;        // csvDFA::State
+  std::string cell;
+  int col;          // column of the current cell
+  bool keep;        // keep_column(col)
+
+  unsigned char cls[256]; // byte -> csvDFA::Class
+  csv_scanner scan;       // skips plain cell content
+  Stats st;
+};
+
+// virtual csv_builder
+struct csvparser : basic_csvparser<csv_builder> {
   csvparser(csv_builder &out,char qchar='"',char sep=',')
+    : basic_csvparser<csv_builder>(out,qchar,sep)
+  {}
+};
+
+// dialect chosen at runtime (e.g. from a config): dispatches to a precompiled instance for
+// csv_rfc4180, csv_tsv and csv_semicolon, otherwise to basic_csvparser<csv_builder>
+class csvparser_dialect {
+  csvparser_dialect(const csvparser_dialect &); // = delete
+  csvparser_dialect &operator=(const csvparser_dialect &);
+public:
+  csvparser_dialect(csv_builder &out,const csv_runtime_dialect &dialect);
+  ~csvparser_dialect();
+
+  // see basic_csvparser
+  bool operator()(const std::string &line);
+  bool operator()(const char *&buf,int len);
+  bool finish();
+  void reset();
+  void set_zero_copy(bool zc);
+  void set_projection(const csv_projection *proj);
+  void set_error_handler(csv_error_handler *eh);
+  const char *error() const;
+
+  bool precompiled() const; // (not the generic csv_runtime_dialect)
+
+private:
+  struct Impl;  // csvparser.cpp
+  template <typename Dialect> struct ImplT;
+  Impl *impl;
+};
+
+// boost::variant based reference implementation (csvfsm.cpp),
+// same interface and semantics as csvparser; kept for differential testing
+struct csvparser_fsm {
+  csvparser_fsm(csv_builder &out,char qchar='"',char sep=',')
     : out(out),
       qchar(qchar),sep(sep),
       errmsg(NULL)
   {}
-  
+
   // NOTE: returns true on error
   bool operator()(const std::string &line); // not required to be linewise
   bool operator()(const char *&buf,int len);
@@ -24,4 +203,231 @@ private:
   const char *errmsg;
 };
 
+template <typename Builder,typename Stats,typename Dialect>
+basic_csvparser<Builder,Stats,Dialect>::basic_csvparser(Builder &out,char qchar,char sep) // {{{
+  : out(out),
+    dialect(qchar,sep),
+    errmsg(NULL),
+    zero_copy(false),
+    proj(NULL),
+    on_error(NULL),
+    offset(0),row_begin(0),
+    bad_msg(NULL),
+    state(csvDFA::Start),
+    col(0),keep(true),
+    scan(this->dialect.qchar(),this->dialect.sep(),scan_stop(),'\n')
+{
+  csvDFA::init_classes(cls,dialect.qchar(),dialect.sep(),dialect.flags());
+}
+// }}}
+
+template <typename Builder,typename Stats,typename Dialect>
+basic_csvparser<Builder,Stats,Dialect>::basic_csvparser(Builder &out,const Dialect &dialect) // {{{
+  : out(out),
+    dialect(dialect),
+    errmsg(NULL),
+    zero_copy(false),
+    proj(NULL),
+    on_error(NULL),
+    offset(0),row_begin(0),
+    bad_msg(NULL),
+    state(csvDFA::Start),
+    col(0),keep(true),
+    scan(this->dialect.qchar(),this->dialect.sep(),scan_stop(),'\n')
+{
+  csvDFA::init_classes(cls,dialect.qchar(),dialect.sep(),dialect.flags());
+}
+// }}}
+
+// TODO?
+template <typename Builder,typename Stats,typename Dialect>
+bool basic_csvparser<Builder,Stats,Dialect>::operator()(const std::string &line) // {{{
+{
+  const char *buf=line.c_str();
+  return (operator())(buf,line.size());
+}
+// }}}
+
+template <typename Builder,typename Stats,typename Dialect>
+bool basic_csvparser<Builder,Stats,Dialect>::operator()(const char *&buf,int len) // {{{
+{
+  st.begin_call();
+  const char *start=buf;
+  const bool ret=parse(buf,len);
+  offset+=buf-start;
+  st.end_call(buf-start);
+  return ret;
+}
+// }}}
+
+template <typename Builder,typename Stats,typename Dialect>
+bool basic_csvparser<Builder,Stats,Dialect>::parse(const char *&buf,int len) // {{{
+{
+  int state=this->state; // (keep in register)
+  bool keep=this->keep;   // (unkept cells are not collected, seg_begin==seg_end)
+  const char *pos=buf,*end=buf+len;
+  // content of the current cell: cell + [seg_begin,seg_end)
+  const char *seg_begin=buf,*seg_end=buf;
+  const csvDFA::Trans (*const table)[csvDFA::NumClasses]=
+    (dialect.flags()&csv_quote_in_unquoted) ? csvDFA::table_quote_in_unquoted : csvDFA::table;
+  while (pos<end) {
+    const csvDFA::Trans &t=table[state][cls[(unsigned char)*pos]];
+    if ( (Stats::enabled)&&(t.next==csvDFA::ReadQuoted)&&(state!=csvDFA::ReadQuoted) ) {
+      if (state==csvDFA::ReadQuotedCheckEscape) {
+        st.escaped();
+      } else {
+        st.quoted();
+      }
+    }
+    if (t.action) {
+      const int action=t.action;
+      if (action&(csvDFA::Aerror|csvDFA::Aresync)) {
+        if (action&csvDFA::Aresync) {
+          bad_row(offset+(pos-buf)+1);
+        } else if ( (!on_error)||(state==csvDFA::ReadError) ) {
+          if (csvDFA::errmsgs[state]) { // (ReadError keeps message)
+            errmsg=csvDFA::errmsgs[state];
+            st.error(pos-buf,col);
+          }
+          this->state=csvDFA::ReadError;
+          this->keep=keep;
+          buf=pos;
+          return true;
+        } else { // lenient: drop the row, incl. the offending byte
+          bad_msg=csvDFA::errmsgs[state];
+          st.error(pos-buf,col);
+          abort_row();
+          cell.clear();
+          seg_begin=seg_end=pos+1;
+          state=csvDFA::SkipRow;
+          pos++;
+          continue;
+        }
+      }
+      if (action&csvDFA::Abegin_row) {
+        row_begin=offset+(pos-buf);
+        begin_row();
+        col=0;
+        keep=keep_column(0);
+      }
+      if ( (action&csvDFA::Aadd)&&(keep) ) {
+        if (pos!=seg_end) { // not contiguous (e.g. escaped qchar)
+          cell.append(seg_begin,seg_end-seg_begin);
+          seg_begin=pos;
+        }
+        seg_end=pos+1;
+      }
+      if (action&csvDFA::Acell) {
+        if (!keep) {
+          // (skipped by projection)
+          st.cell(0);
+        } else if ( (zero_copy)&&(cell.empty()) ) {
+          st.cell(seg_end-seg_begin);
+          emit_cell(seg_begin,seg_end-seg_begin);
+        } else {
+          cell.append(seg_begin,seg_end-seg_begin);
+          st.cell(cell.size());
+          emit_cell(cell.c_str(),cell.size());
+          cell.clear();
+        }
+        seg_begin=seg_end;
+        keep=keep_column(++col);
+      } else if (action&csvDFA::Anull_cell) {
+        assert( (cell.empty())&&(seg_begin==seg_end) );
+        st.cell(0);
+        if (keep) {
+          emit_cell(NULL,0);
+        }
+        keep=keep_column(++col);
+      }
+      if (action&csvDFA::Aend_row) {
+        st.row();
+        end_row();
+      }
+    }
+    state=t.next;
+    pos++;
+
+    // bulk-consume plain content (same as repeated Aadd in these states)
+    const char *next;
+    if (state==csvDFA::ReadUnquoted) {
+      next=scan(pos,end);
+      // (same state as stepping through: only the error message after whitespace differs)
+      if ( (scan_skips_ws())&&(next!=pos)&&(cls[(unsigned char)next[-1]]==csvDFA::Cwhitespace) ) {
+        state=csvDFA::ReadUnquotedWhitespace;
+      }
+    } else if (state==csvDFA::ReadQuoted) {
+      next=(const char *)memchr(pos,dialect.qchar(),end-pos);
+      if (!next) {
+        next=end;
+      }
+    } else {
+      continue;
+    }
+    if ( (next!=pos)&&(keep) ) {
+      if (pos!=seg_end) {
+        cell.append(seg_begin,seg_end-seg_begin);
+        seg_begin=pos;
+      }
+      seg_end=next;
+    }
+    pos=next;
+  }
+  // chunk boundary: keep partial cell
+  cell.append(seg_begin,seg_end-seg_begin);
+
+  this->state=state;
+  this->keep=keep;
+  buf=pos;
+  return false;
+}
+// }}}
+
+template <typename Builder,typename Stats,typename Dialect>
+bool basic_csvparser<Builder,Stats,Dialect>::finish() // {{{
+{
+  if ( (state==csvDFA::ReadQuoted)&&(on_error) ) {
+    bad_msg="unexpected end of input in quoted string";
+    st.error(0,col);
+    abort_row();
+    cell.clear();
+    state=csvDFA::SkipRow;
+  }
+  if (state==csvDFA::ReadQuoted) {
+    errmsg="unexpected end of input in quoted string";
+    state=csvDFA::ReadError;
+    st.error(0,col);
+    return true;
+  } else if ( (state>=csvDFA::SkipRow)&&(state<=csvDFA::SkipRowQuotedCheckEnd) ) {
+    bad_row(offset);
+    state=csvDFA::Start;
+    return false;
+  } else if ( (state==csvDFA::Start)||(state==csvDFA::StartAfterCR) ) {
+    return false;
+  }
+  // same as newline, in all other states (not counted as input)
+  static const char nl='\n';
+  const char *buf=&nl;
+  return parse(buf,1);
+}
+// }}}
+
+template <typename Builder,typename Stats,typename Dialect>
+void basic_csvparser<Builder,Stats,Dialect>::reset() // {{{
+{
+  state=csvDFA::Start;
+  cell.clear();
+  col=0;
+  keep=true;
+  errmsg=NULL;
+  offset=row_begin=0;
+  bad_msg=NULL;
+  st.reset();
+}
+// }}}
+
+#if defined(__GXX_EXPERIMENTAL_CXX0X__)||(__cplusplus>=201103L)
+extern template class basic_csvparser<csv_builder>;  // csvparser.cpp
+#endif
+
 #endif
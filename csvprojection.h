@@ -0,0 +1,66 @@
+#ifndef _CSVPROJECTION_H
+#define _CSVPROJECTION_H
+
+#include <algorithm>
+#include <vector>
+
+// Set of column indexes a parser delivers (see basic_csvparser::set_projection);
+// other cells are only scanned, not copied or passed to the builder.
+// Kept cells still arrive in column order, i.e. the k-th cell of a row is column columns()[k]
+class csv_projection {
+public:
+  csv_projection() : all(true),last(-1),skipped(false),consulted(false) {} // keeps all columns
+  explicit csv_projection(const std::vector<int> &cidxs) : skipped(false),consulted(false) { set(cidxs); }
+
+  void set(const std::vector<int> &cidxs) { // (duplicates and negative cidxs are ignored)
+    all=false;
+    cols.clear();
+    for (size_t iA=0;iA<cidxs.size();iA++) {
+      if (cidxs[iA]>=0) {
+        cols.push_back(cidxs[iA]);
+      }
+    }
+    std::sort(cols.begin(),cols.end());
+    cols.erase(std::unique(cols.begin(),cols.end()),cols.end());
+
+    last=(cols.empty()) ? -1 : cols.back();
+    mask.assign(last+1,0);
+    for (size_t iA=0;iA<cols.size();iA++) {
+      mask[cols[iA]]=1;
+    }
+  }
+  void clear() { // keep all
+    all=true;
+    last=-1;
+    mask.clear();
+    cols.clear();
+  }
+
+  // skips the rest of the current row, e.g. set by a builder's cell() when a row is filtered out;
+  // the builder resets it in begin_row()
+  void skip_row(bool skip) { skipped=skip; }
+
+  bool keep(int cidx) const { // (called by the parser)
+    consulted=true;
+    return (!skipped)&&(contains(cidx));
+  }
+  bool contains(int cidx) const {
+    return (all)||( (cidx<=last)&&(mask[cidx]) );
+  }
+  // whether keep() was called since clear_consulted(), i.e. whether a parser applies the
+  // projection (otherwise the builder gets all cells)
+  bool was_consulted() const { return consulted; }
+  void clear_consulted() { consulted=false; }
+  bool keeps_all() const { return all; }
+  const std::vector<int> &columns() const { return cols; } // sorted (empty for keeps_all())
+
+private:
+  bool all;
+  int last;
+  std::vector<char> mask;  // [cidx], up to last
+  std::vector<int> cols;
+  bool skipped;
+  mutable bool consulted;
+};
+
+#endif
@@ -0,0 +1,207 @@
+#include "csvreader.h"
+#include "csvzinput.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+void csvreader::batch::cell(const char *buf,int len) // {{{
+{
+  Cell c;
+  if (!buf) {
+    c.buf=NULL;
+    c.len=-1;
+    c.off=0;
+  } else if ( (buf>=lo)&&(buf+len<=hi) ) { // zero-copy: points into chunk
+    c.buf=buf;
+    c.len=len;
+    c.off=0;
+  } else { // parser scratch (e.g. unescaped)
+    c.buf=NULL;
+    c.len=len;
+    c.off=data.size();
+    data.append(buf,len);
+  }
+  cells.push_back(c);
+}
+// }}}
+
+csvreader::csvreader(char qchar,char sep) // {{{
+  : parser(rows,qchar,sep),
+    errmsg(NULL),
+    next(0),
+    fd(-1),
+    zin(NULL),
+    at_end(false)
+{
+  parser.set_zero_copy(true);
+}
+// }}}
+
+// drop consumed rows; unread ones (e.g. feed() twice) and the incomplete last row
+// (already copied to data, see end_chunk()) are kept
+void csvreader::begin_chunk(const char *buf,int len) // {{{
+{
+  const size_t start=(next>0) ? rows.row_ends[next-1] : 0;
+  spare.clear();
+  for (size_t iA=start;iA<rows.cells.size();iA++) {
+    batch::Cell &c=rows.cells[iA];
+    if ( (!c.buf)&&(c.len>=0) ) {
+      const int off=spare.size();
+      spare.append(rows.data,c.off,c.len);
+      c.off=off;
+    }
+  }
+  rows.data.swap(spare);
+  rows.cells.erase(rows.cells.begin(),rows.cells.begin()+start);
+  rows.row_ends.erase(rows.row_ends.begin(),rows.row_ends.begin()+next);
+  for (size_t iA=0;iA<rows.row_ends.size();iA++) {
+    rows.row_ends[iA]-=start;
+  }
+  next=0;
+
+  rows.lo=buf;
+  rows.hi=buf+len;
+}
+// }}}
+
+// cells of the incomplete last row must not point into the chunk
+void csvreader::end_chunk() // {{{
+{
+  const size_t start=(rows.row_ends.empty()) ? 0 : rows.row_ends.back();
+  for (size_t iA=start;iA<rows.cells.size();iA++) {
+    batch::Cell &c=rows.cells[iA];
+    if (c.buf) {
+      c.off=rows.data.size();
+      rows.data.append(c.buf,c.len);
+      c.buf=NULL;
+    }
+  }
+  rows.lo=rows.hi=NULL;
+}
+// }}}
+
+bool csvreader::feed(const char *buf,int len) // {{{
+{
+  if (errmsg) {
+    return true;
+  }
+  begin_chunk(buf,len);
+  const bool ret=parser(buf,len);
+  end_chunk();
+  if (ret) {
+    errmsg=parser.error();
+  }
+  return ret;
+}
+// }}}
+
+bool csvreader::finish() // {{{
+{
+  if (errmsg) {
+    return true;
+  }
+  begin_chunk(NULL,0);
+  const bool ret=parser.finish();
+  end_chunk();
+  if (ret) {
+    errmsg=parser.error();
+  }
+  return ret;
+}
+// }}}
+
+void csvreader::read_from(int fd,size_t chunksize) // {{{
+{
+  this->fd=fd;
+  zin=NULL;
+  inbuf.resize((chunksize) ? chunksize : 1);
+  at_end=false;
+}
+// }}}
+
+void csvreader::read_from(csv_zinput &in) // {{{
+{
+  fd=-1;
+  zin=&in;
+  at_end=false;
+}
+// }}}
+
+// NOTE: returns false at end of input or on error
+bool csvreader::refill() // {{{
+{
+  if ( ( (fd<0)&&(!zin) )||(at_end)||(errmsg) ) {
+    return false;
+  } else if (zin) {
+    const char *buf;
+    size_t len;
+    if (zin->next(buf,len)) {
+      feed(buf,len);
+    } else if (zin->error()) {
+      errmsg=zin->error();
+      return false;
+    } else {
+      at_end=true;
+      finish();
+    }
+    return true;
+  }
+  ssize_t res;
+  do {
+    res=read(fd,&inbuf[0],inbuf.size());
+  } while ( (res<0)&&(errno==EINTR) );
+  if (res<0) {
+    errmsg=strerror(errno);
+    return false;
+  } else if (res==0) {
+    at_end=true;
+    finish();
+    return true; // (last row, if any)
+  }
+  feed(&inbuf[0],res);
+  return true;
+}
+// }}}
+
+bool csvreader::next_row(csv_row &ret) // {{{
+{
+  while (next>=rows.row_ends.size()) {
+    if (!refill()) {
+      return false;
+    }
+  }
+  const size_t start=(next>0) ? rows.row_ends[next-1] : 0,
+               end=rows.row_ends[next];
+  next++;
+
+  row.resize(end-start);
+  for (size_t iA=start;iA<end;iA++) {
+    const batch::Cell &c=rows.cells[iA];
+    csv_cell &out=row[iA-start];
+    if (c.buf) {
+      out.buf=c.buf;
+    } else if (c.len<0) {
+      out.buf=NULL;
+    } else {
+      out.buf=rows.data.data()+c.off;
+    }
+    out.len=(c.len<0) ? 0 : c.len;
+  }
+  ret.cells=(row.empty()) ? NULL : &row[0];
+  ret.count=row.size();
+  return true;
+}
+// }}}
+
+void csvreader::reset() // {{{
+{
+  parser.reset();
+  rows.cells.clear();
+  rows.row_ends.clear();
+  rows.data.clear();
+  next=0;
+  errmsg=NULL;
+  at_end=false;
+}
+// }}}
+
@@ -0,0 +1,110 @@
+#ifndef _CSVREADER_H
+#define _CSVREADER_H
+
+#include <string>
+#include <vector>
+#include "csvparser.h"
+
+// view of one cell; not NUL-terminated
+struct csv_cell {
+  const char *buf;  // NULL: NULL cell
+  int len;
+
+  bool isNull() const { return !buf; }
+  std::string str() const { return (buf) ? std::string(buf,len) : std::string(); }
+};
+
+class csv_zinput;  // csvzinput.h
+class csvreader;
+class csv_row {
+public:
+  csv_row() : cells(NULL),count(0) {}
+
+  int size() const { return count; }
+  const csv_cell &operator[](int cidx) const { return cells[cidx]; }
+private:
+  friend class csvreader;
+  const csv_cell *cells;
+  int count;
+};
+
+// Pull-style reader:
+//   reader.feed(buf,len);  // or: reader.read_from(fd);
+//   while (reader.next_row(row)) { row[i] ... }
+// Rows of each input chunk are recorded (zero-copy, where possible) into buffers that are
+// reused for the next chunk, i.e. steady-state parsing does not allocate.
+// A row (and its cells) stays valid until the next call of next_row(), feed() or finish().
+class csvreader {
+  csvreader(const csvreader &); // = delete
+  csvreader &operator=(const csvreader &);
+public:
+  csvreader(char qchar='"',char sep=',');
+
+  // the chunk must stay valid until next_row() returned false; unread rows of earlier
+  // chunks are kept (queued), rows before an error are still returned by next_row()
+  // NOTE: returns true on error
+  bool feed(const char *buf,int len);
+  bool feed(const std::string &chunk) { return feed(chunk.data(),chunk.size()); }
+  bool finish(); // end of input: completes a last row without trailing newline
+
+  // read()s chunks from fd on demand (finish() at eof); fd is not closed
+  void read_from(int fd,size_t chunksize=64*1024);
+  // chunks of an opened csv_zinput (e.g. compressed); in must outlive the reading
+  void read_from(csv_zinput &in);
+
+  // false: all rows of the input fed so far are consumed (or end of input / error)
+  bool next_row(csv_row &row);
+
+  const char *error() const { return errmsg; }
+  void reset();
+
+  // lenient parsing, see basic_csvparser::set_error_handler
+  void set_error_handler(csv_error_handler *eh) { parser.set_error_handler(eh); }
+
+private:
+  // records cells of the current chunk (csv_builder interface)
+  class batch {
+  public:
+    batch() : lo(NULL),hi(NULL) {}
+
+    void begin_row() {}
+    void cell(const char *buf,int len);
+    void end_row() {
+      row_ends.push_back(cells.size());
+    }
+    void abort_row() {
+      cells.resize((row_ends.empty()) ? 0 : row_ends.back());
+    }
+  private:
+    friend class csvreader;
+    struct Cell {
+      const char *buf; // NULL: len<0 ? NULL cell : data+off
+      int len;
+      int off;
+    };
+    const char *lo,*hi;   // zero-copy range: current chunk
+    std::vector<Cell> cells;
+    std::vector<size_t> row_ends;
+    std::string data;     // unescaped cells, incomplete row
+  };
+
+private:
+  void begin_chunk(const char *buf,int len);
+  void end_chunk();
+  bool refill();
+private:
+  batch rows;
+  basic_csvparser<batch> parser;
+  const char *errmsg;
+
+  size_t next;                  // rows.row_ends index
+  std::vector<csv_cell> row;    // cells of the current row
+  std::string spare;            // (for compaction of rows.data)
+
+  int fd;                       // read_from(), or -1
+  csv_zinput *zin;              // read_from(), or NULL
+  std::vector<char> inbuf;
+  bool at_end;
+};
+
+#endif
@@ -0,0 +1,133 @@
+#include "csvscan.h"
+#include <string.h>
+
+#if defined(__GNUC__)&&(defined(__x86_64__)||defined(__i386__))
+  #define CSVSCAN_X86
+  #include <emmintrin.h>
+  #include <immintrin.h>
+#endif
+
+csv_scanner::csv_scanner(char c0,char c1,char c2,char c3) // {{{
+{
+  c[0]=c0;
+  c[1]=c1;
+  c[2]=c2;
+  c[3]=c3;
+  memset(special,0,sizeof(special));
+  for (int iA=0;iA<4;iA++) {
+    special[(unsigned char)c[iA]]=true;
+  }
+}
+// }}}
+
+const char *csv_scanner::scan_scalar(const csv_scanner &self,const char *buf,const char *end) // {{{
+{
+  while ( (buf<end)&&(!self.special[(unsigned char)*buf]) ) {
+    buf++;
+  }
+  return buf;
+}
+// }}}
+
+#ifdef CSVSCAN_X86
+const char *csv_scanner::scan_sse2(const csv_scanner &self,const char *buf,const char *end) // {{{
+{
+  const __m128i v0=_mm_set1_epi8(self.c[0]),
+                v1=_mm_set1_epi8(self.c[1]),
+                v2=_mm_set1_epi8(self.c[2]),
+                v3=_mm_set1_epi8(self.c[3]);
+  while (end-buf>=16) {
+    const __m128i x=_mm_loadu_si128((const __m128i *)buf);
+    const __m128i m=_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x,v0),_mm_cmpeq_epi8(x,v1)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(x,v2),_mm_cmpeq_epi8(x,v3)));
+    const int mask=_mm_movemask_epi8(m);
+    if (mask) {
+      return buf+__builtin_ctz(mask);
+    }
+    buf+=16;
+  }
+  return scan_scalar(self,buf,end);
+}
+// }}}
+
+__attribute__((target("avx2")))
+const char *csv_scanner::scan_avx2(const csv_scanner &self,const char *buf,const char *end) // {{{
+{
+  const __m256i v0=_mm256_set1_epi8(self.c[0]),
+                v1=_mm256_set1_epi8(self.c[1]),
+                v2=_mm256_set1_epi8(self.c[2]),
+                v3=_mm256_set1_epi8(self.c[3]);
+  while (end-buf>=32) {
+    const __m256i x=_mm256_loadu_si256((const __m256i *)buf);
+    const __m256i m=_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x,v0),_mm256_cmpeq_epi8(x,v1)),
+                                    _mm256_or_si256(_mm256_cmpeq_epi8(x,v2),_mm256_cmpeq_epi8(x,v3)));
+    const unsigned int mask=_mm256_movemask_epi8(m);
+    if (mask) {
+      return buf+__builtin_ctz(mask);
+    }
+    buf+=32;
+  }
+  return scan_sse2(self,buf,end);
+}
+// }}}
+#else
+const char *csv_scanner::scan_sse2(const csv_scanner &self,const char *buf,const char *end)
+{
+  return scan_scalar(self,buf,end);
+}
+
+const char *csv_scanner::scan_avx2(const csv_scanner &self,const char *buf,const char *end)
+{
+  return scan_scalar(self,buf,end);
+}
+#endif
+
+csv_scanner::Impl csv_scanner::best() // {{{
+{
+#ifdef CSVSCAN_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return AVX2;
+  } else if (__builtin_cpu_supports("sse2")) {
+    return SSE2;
+  }
+#endif
+  return Scalar;
+}
+// }}}
+
+csv_scanner::Impl csv_scanner::current() // {{{
+{
+  if (scan==&scan_avx2) {
+    return AVX2;
+  } else if (scan==&scan_sse2) {
+    return SSE2;
+  }
+  return Scalar;
+}
+// }}}
+
+void csv_scanner::use(Impl impl) // {{{
+{
+  const Impl max=best();
+  if (impl>max) {
+    impl=max;
+  }
+  switch (impl) {
+  case Scalar: scan=&scan_scalar; break;
+  case SSE2:   scan=&scan_sse2; break;
+  case AVX2:   scan=&scan_avx2; break;
+  }
+}
+// }}}
+
+static csv_scanner::Impl init_scan() // {{{
+{
+  const csv_scanner::Impl ret=csv_scanner::best();
+  csv_scanner::use(ret);
+  return ret;
+}
+// }}}
+
+csv_scanner::scan_fn csv_scanner::scan=&csv_scanner::scan_scalar;
+static const csv_scanner::Impl scan_init=init_scan();
@@ -0,0 +1,32 @@
+#ifndef _CSVSCAN_H
+#define _CSVSCAN_H
+
+// finds the next occurrence of any of (up to) four bytes
+class csv_scanner {
+public:
+  enum Impl { Scalar, SSE2, AVX2 };
+
+  csv_scanner(char c0,char c1,char c2,char c3);
+
+  // returns first position in [buf,end) matching one of the bytes, or end
+  const char *operator()(const char *buf,const char *end) const {
+    return scan(*this,buf,end);
+  }
+
+  static Impl best();      // as detected at runtime
+  static Impl current();
+  static void use(Impl impl); // for testing / benchmarking; clamped to best()
+
+private:
+  typedef const char *(*scan_fn)(const csv_scanner &self,const char *buf,const char *end);
+  static scan_fn scan;
+
+  static const char *scan_scalar(const csv_scanner &self,const char *buf,const char *end);
+  static const char *scan_sse2(const csv_scanner &self,const char *buf,const char *end);
+  static const char *scan_avx2(const csv_scanner &self,const char *buf,const char *end);
+private:
+  char c[4];
+  bool special[256];
+};
+
+#endif
@@ -0,0 +1,118 @@
+#ifndef _CSVSTATS_H
+#define _CSVSTATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+// Stats policies for basic_csvparser<Builder,Stats> (hooks called by the parser).
+// csv_nostats (default): all hooks empty, i.e. compiled out of the parse loop
+
+struct csv_nostats { // {{{
+  static const bool enabled=false;  // (guards per-transition hooks: quoted, escaped)
+
+  void begin_call() {}
+  void end_call(size_t bytes) {}
+  void row() {}
+  void cell(int len) {}
+  void quoted() {}
+  void escaped() {}
+  void bad_row() {}
+  void enter_builder() {}
+  void leave_builder() {}
+  void error(size_t offset,int col) {}
+  void reset() {}
+};
+// }}}
+
+// counters, time spent in operator() and position of the first error
+struct csv_stats { // {{{
+  static const bool enabled=true;
+
+  csv_stats() { reset(); }
+
+  size_t bytes;           // consumed input (finish() adds none)
+  size_t rows;            // completed rows
+  size_t cells;           // incl. NULL and projected-out cells
+  size_t quoted_cells;
+  size_t escaped_quotes;  // doubled qchars
+  size_t bad_rows;        // skipped (lenient parsing)
+  int max_cell_len;       // of delivered cells
+  uint64_t total_ns;      // in operator()(), incl. builder callbacks
+  uint64_t builder_ns;    // in builder callbacks (only csv_timed_stats)
+
+  bool has_error;
+  size_t error_offset;    // byte offset of the offending byte (bytes: end of input)
+  size_t error_row;       // 0-based, i.e. rows before it
+  int error_col;          // 0-based cell index in that row
+
+  uint64_t parse_ns() const { return total_ns-builder_ns; }
+
+  void begin_call() {
+    t0=now_ns();
+  }
+  void end_call(size_t len) {
+    bytes+=len;
+    total_ns+=now_ns()-t0;
+  }
+  void row() {
+    rows++;
+  }
+  void cell(int len) {
+    cells++;
+    if (len>max_cell_len) {
+      max_cell_len=len;
+    }
+  }
+  void quoted() {
+    quoted_cells++;
+  }
+  void escaped() {
+    escaped_quotes++;
+  }
+  void bad_row() {
+    bad_rows++;
+  }
+  void enter_builder() {}
+  void leave_builder() {}
+  void error(size_t offset,int col) { // offset: in current call
+    if (!has_error) {
+      has_error=true;
+      error_offset=bytes+offset;
+      error_row=rows;
+      error_col=col;
+    }
+  }
+  void reset() {
+    bytes=rows=cells=quoted_cells=escaped_quotes=bad_rows=0;
+    max_cell_len=0;
+    total_ns=builder_ns=0;
+    has_error=false;
+    error_offset=error_row=0;
+    error_col=0;
+    t0=tb=0;
+  }
+
+  static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000u+ts.tv_nsec;
+  }
+
+protected:
+  uint64_t t0,tb;
+};
+// }}}
+
+// additionally times every builder callback (two clock reads per cell!)
+struct csv_timed_stats : csv_stats { // {{{
+  void enter_builder() {
+    tb=now_ns();
+  }
+  void leave_builder() {
+    builder_ns+=now_ns()-tb;
+  }
+};
+// }}}
+
+#endif
@@ -0,0 +1,70 @@
+#ifndef _CSVTHREADS_H
+#define _CSVTHREADS_H
+
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+
+// runs task(ctx,0..n-1) on threads (incl. the calling one)
+class csv_parallel_for { // {{{
+public:
+  typedef void (*task_fn)(void *ctx,int idx);
+  csv_parallel_for(task_fn task,void *ctx,int n)
+    : task(task),ctx(ctx),n(n),next(0)
+  {
+    pthread_mutex_init(&mutex,NULL);
+  }
+  ~csv_parallel_for() {
+    pthread_mutex_destroy(&mutex);
+  }
+
+  void run(int threads) {
+    std::vector<pthread_t> tids;
+    tids.reserve(threads);
+    for (int iA=1;iA<threads;iA++) {
+      pthread_t tid;
+      if (pthread_create(&tid,NULL,&thread_main,this)!=0) {
+        break; // continue with fewer threads
+      }
+      tids.push_back(tid);
+    }
+    thread_main(this);
+    for (int iA=0;iA<(int)tids.size();iA++) {
+      pthread_join(tids[iA],NULL);
+    }
+  }
+
+private:
+  static void *thread_main(void *arg) {
+    csv_parallel_for &self=*(csv_parallel_for *)arg;
+    while (1) {
+      pthread_mutex_lock(&self.mutex);
+      const int idx=(self.next<self.n) ? self.next++ : -1;
+      pthread_mutex_unlock(&self.mutex);
+      if (idx<0) {
+        break;
+      }
+      self.task(self.ctx,idx);
+    }
+    return NULL;
+  }
+private:
+  task_fn task;
+  void *ctx;
+  int n,next;
+  pthread_mutex_t mutex;
+};
+// }}}
+
+// threads<=0: number of online cpus
+inline int csv_threads(int threads) // {{{
+{
+  if (threads<=0) {
+    const long ncpu=sysconf(_SC_NPROCESSORS_ONLN);
+    threads=(ncpu>0) ? ncpu : 1;
+  }
+  return threads;
+}
+// }}}
+
+#endif
@@ -1,80 +1,138 @@
 #ifndef _CSVWRITER_H
 #define _CSVWRITER_H
 
+#include <string.h>
+#include <string>
 #include "csvbase.h"
 
+// smart_quote looks for qchar, sep and '\n' bytewise (header-only);
+// -DCSV_WRITER_SIMD: with csv_scanner instead (link csvscan.cpp; same setting in all units)
+#ifndef CSV_WRITER_SIMD
+class csv_writer_scanner {
+public:
+  csv_writer_scanner(char c0,char c1,char c2,char c3) {
+    c[0]=c0; c[1]=c1; c[2]=c2; c[3]=c3;
+  }
+
+  const char *operator()(const char *buf,const char *end) const {
+    for (;buf<end;buf++) {
+      const char ch=*buf;
+      if ( (ch==c[0])||(ch==c[1])||(ch==c[2])||(ch==c[3]) ) {
+        return buf;
+      }
+    }
+    return end;
+  }
+private:
+  char c[4];
+};
+#else
+#include "csvscan.h"
+typedef csv_scanner csv_writer_scanner;
+#endif
+
 #if !defined(__GXX_EXPERIMENTAL_CXX0X__)&&(__cplusplus<201103L)
   #define override
 #endif
 
-template <typename Output>  // ("asdf",4)
+// Outputs with mark() / rewind() retract a partial row themselves (see csv_outbuf);
+// for all others csv_writer keeps the current row until end_row()
+template <typename Output>
+struct csv_output_rewindable { static const bool value=false; };
+
+template <typename Output,bool=csv_output_rewindable<Output>::value>
+struct csv_writer_row {
+  void begin(Output &out) {}
+  void put(Output &out,const char *buf,int len) { row.append(buf,len); }
+  void end(Output &out) {
+    out(row.data(),row.size());
+    row.clear();
+  }
+  void abort(Output &out) { row.clear(); }
+private:
+  std::string row;
+};
+
+template <typename Output>
+struct csv_writer_row<Output,true> {
+  void begin(Output &out) { out.mark(); }
+  void put(Output &out,const char *buf,int len) { out(buf,len); }
+  void end(Output &out) {}
+  void abort(Output &out) { out.rewind(); }
+};
+
+template <typename Output>  // ("asdf",4); also a reference, e.g. csv_outbuf &
 class csv_writer : public csv_builder { // {{{
 public:
   csv_writer(char qchar='"',char sep=',',bool smart_quote=false)
     : qchar(qchar),sep(sep),
       smart_quote(smart_quote),
-      first(true)
+      first(true),
+      scan(qchar,sep,'\n','\n')
   {}
   csv_writer(Output out,char qchar='"',char sep=',',bool smart_quote=false)
     : out(out),
       qchar(qchar),sep(sep),
       smart_quote(smart_quote),
-      first(true)
+      first(true),
+      scan(qchar,sep,'\n','\n')
   {}
 
   void begin_row() override {
     first=true;
+    row.begin(out);
   }
   void cell(const char *buf,int len) override {
     if (!first) {
-      out(&sep,1);
+      put(&sep,1);
     } else {
       first=false;
     }
     if (!buf) {
       return;
     }
-    if ( (smart_quote)&&(!need_quote(buf,len)) ) {
-      out(buf,len);
-    } else {
-      out(&qchar,1);
-
-      const char *pos=buf;
-      while (len>0) {
-        if (*pos==qchar) {
-          out(buf,pos-buf+1); // first qchar
-          buf=pos; // qchar still there! (second one)
-        }
-        pos++;
-        len--;
+    const char *end=buf+len;
+    const char *pos=buf;
+    if (smart_quote) {
+      pos=scan(buf,end); // need_quote: first qchar, sep or '\n'
+      if (pos==end) {
+        put(buf,len);
+        return;
       }
-      out(buf,pos-buf);
+    }
+    put(&qchar,1);
 
-      out(&qchar,1);
+    // (no qchar before pos)
+    while ( (pos=(const char *)memchr(pos,qchar,end-pos))!=NULL ) {
+      put(buf,pos-buf+1); // first qchar
+      buf=pos; // qchar still there! (second one)
+      pos++;
     }
+    put(buf,end-buf);
+
+    put(&qchar,1);
   }
   void end_row() override {
-    out("\n",1);
+    put("\n",1);
+    row.end(out);
   }
-private:
-  bool need_quote(const char *buf,int len) const { // {{{
-    while (len>0) {
-      if ( (*buf==qchar)||(*buf==sep)||(*buf=='\n') ) {
-        return true;
-      }
-      buf++;
-      len--;
-    }
-    return false;
+  // (lenient parsing) drops the partial row
+  void abort_row() override {
+    row.abort(out);
   }
-  // }}}
+
+  Output &output() { return out; } // e.g. csv_outbuf::flush()
+private:
+  void put(const char *buf,int len) { row.put(out,buf,len); }
 private:
   Output out;
+  csv_writer_row<Output> row;
   char qchar;
   char sep;
   bool smart_quote;
 
   bool first;
+  csv_writer_scanner scan;
 };
 // }}}
 
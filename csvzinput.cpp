@@ -0,0 +1,368 @@
+#include "csvzinput.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <zlib.h>
+#ifdef CSV_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+csv_zinput::csv_zinput(size_t bufsize,int nbufs) // {{{
+  : bufsize((bufsize) ? bufsize : 1),
+    fd(-1),
+    fmt(Plain),
+    rawpos(0),rawlen(0),
+    raw_eof(false),
+    zs(NULL),zpending(false),
+    ring((nbufs>1) ? nbufs : 2),
+    head(0),tail(0),filled(0),
+    held(false),done(false),stop(false),
+    started(false)
+{
+  wake[0]=wake[1]=-1;
+  pthread_mutex_init(&mutex,NULL);
+  pthread_cond_init(&cond,NULL);
+}
+// }}}
+
+csv_zinput::~csv_zinput() // {{{
+{
+  if (started) {
+    pthread_mutex_lock(&mutex);
+    stop=true;
+    pthread_cond_broadcast(&cond);
+    pthread_mutex_unlock(&mutex);
+    ssize_t res;
+    do {
+      res=write(wake[1],"",1);
+    } while ( (res<0)&&(errno==EINTR) );
+    pthread_join(tid,NULL);
+  }
+  for (int iA=0;iA<2;iA++) {
+    if (wake[iA]>=0) {
+      ::close(wake[iA]);
+    }
+  }
+  close();
+  pthread_cond_destroy(&cond);
+  pthread_mutex_destroy(&mutex);
+}
+// }}}
+
+csv_zinput::Format csv_zinput::detect(const unsigned char *buf,size_t len) // {{{
+{
+  // (no raw zlib: its 2 byte header is too likely at the start of plain text)
+  if ( (len>=3)&&(buf[0]==0x1f)&&(buf[1]==0x8b)&&(buf[2]==8) ) { // (deflate)
+    return Gzip;
+  } else if ( (len>=4)&&(buf[0]==0x28)&&(buf[1]==0xb5)&&(buf[2]==0x2f)&&(buf[3]==0xfd) ) {
+    return Zstd;
+  }
+  return Plain;
+}
+// }}}
+
+bool csv_zinput::open(int fd) // {{{
+{
+  if (started) {
+    errno=EBUSY;
+    return true;
+  }
+  this->fd=fd;
+  for (size_t iA=0;iA<ring.size();iA++) {
+    ring[iA].data.resize(bufsize);
+    ring[iA].len=0;
+  }
+  raw.resize((bufsize<4) ? 4 : bufsize);
+  if ( (wake[0]<0)&&(pipe(wake)!=0) ) {
+    wake[0]=wake[1]=-1;
+    return true;
+  }
+  const int err=pthread_create(&tid,NULL,&thread_main,this);
+  if (err) { // (returns the error, errno is not set)
+    errno=err;
+    return true;
+  }
+  started=true;
+  return false;
+}
+// }}}
+
+bool csv_zinput::next(const char *&buf,size_t &len) // {{{
+{
+  pthread_mutex_lock(&mutex);
+  if (held) { // release previous
+    tail=(tail+1)%ring.size();
+    filled--;
+    held=false;
+    pthread_cond_broadcast(&cond);
+  }
+  while ( (filled==0)&&(!done)&&(started) ) {
+    pthread_cond_wait(&cond,&mutex);
+  }
+  if (filled==0) {
+    pthread_mutex_unlock(&mutex);
+    return false;
+  }
+  held=true;
+  buf=&ring[tail].data[0];
+  len=ring[tail].len;
+  pthread_mutex_unlock(&mutex);
+  return true;
+}
+// }}}
+
+const char *csv_zinput::error() const // {{{
+{
+  // (errmsg is only set before done)
+  return (errmsg.empty()) ? NULL : errmsg.c_str();
+}
+// }}}
+
+void *csv_zinput::thread_main(void *arg) // {{{
+{
+  ((csv_zinput *)arg)->produce();
+  return NULL;
+}
+// }}}
+
+csv_zinput::Buffer *csv_zinput::acquire() // {{{
+{
+  pthread_mutex_lock(&mutex);
+  while ( (filled==(int)ring.size())&&(!stop) ) {
+    pthread_cond_wait(&cond,&mutex);
+  }
+  Buffer *ret=(stop) ? NULL : &ring[head];
+  pthread_mutex_unlock(&mutex);
+  return ret;
+}
+// }}}
+
+void csv_zinput::publish(Buffer *buf) // {{{
+{
+  pthread_mutex_lock(&mutex);
+  if (buf) {
+    head=(head+1)%ring.size();
+    filled++;
+  } else {
+    done=true;
+  }
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+}
+// }}}
+
+void csv_zinput::fail(const char *msg) // {{{
+{
+  pthread_mutex_lock(&mutex);
+  errmsg=(msg) ? msg : "decompression error";
+  done=true;
+  pthread_cond_broadcast(&cond);
+  pthread_mutex_unlock(&mutex);
+}
+// }}}
+
+ssize_t csv_zinput::read_input(char *buf,size_t len) // {{{
+{
+  struct pollfd pfd[2];
+  pfd[0].fd=fd;
+  pfd[0].events=POLLIN;
+  pfd[1].fd=wake[0];
+  pfd[1].events=POLLIN;
+  while (1) {
+    pfd[0].revents=pfd[1].revents=0;
+    if (poll(pfd,2,-1)<0) {
+      if (errno==EINTR) {
+        continue;
+      }
+      return -1;
+    } else if (pfd[1].revents) {
+      return -2;
+    }
+    const ssize_t res=read(fd,buf,len);
+    if ( (res>=0)||(errno!=EINTR) ) {
+      return res;
+    }
+  }
+}
+// }}}
+
+bool csv_zinput::read_raw() // {{{
+{
+  if (raw_eof) {
+    return false;
+  }
+  const ssize_t res=read_input(&raw[0],raw.size());
+  if (res==-2) {
+    return false;
+  } else if (res<0) {
+    fail(strerror(errno));
+    return false;
+  } else if (res==0) {
+    raw_eof=true;
+    return false;
+  }
+  rawpos=0;
+  rawlen=res;
+  return true;
+}
+// }}}
+
+void csv_zinput::produce() // {{{
+{
+  // magic bytes
+  while ( (rawlen<4)&&(!raw_eof) ) {
+    const ssize_t res=read_input(&raw[rawlen],raw.size()-rawlen);
+    if (res==-2) { // stopped
+      return;
+    } else if (res<0) {
+      fail(strerror(errno));
+      return;
+    } else if (res==0) {
+      raw_eof=true;
+    }
+    rawlen+=res;
+  }
+  fmt=detect((const unsigned char *)&raw[0],rawlen);
+
+  if (fmt==Gzip) {
+    z_stream *z=new z_stream;
+    memset(z,0,sizeof(*z));
+    zs=z;
+    if (inflateInit2(z,15+16)!=Z_OK) { // (gzip header)
+      fail(z->msg);
+      return;
+    }
+  } else if (fmt==Zstd) {
+#ifdef CSV_HAVE_ZSTD
+    ZSTD_DStream *ds=ZSTD_createDStream();
+    zs=ds;
+    if ( (!ds)||(ZSTD_isError(ZSTD_initDStream(ds))) ) {
+      fail("zstd init failed");
+      return;
+    }
+#else
+    fail("zstd input, but built without CSV_HAVE_ZSTD");
+    return;
+#endif
+  }
+
+  while (1) {
+    Buffer *out=acquire();
+    if (!out) { // stopped
+      return;
+    }
+    out->len=0;
+    bool end=false;
+    if (fmt==Plain) {
+      // pending raw bytes (magic), then directly into the buffer
+      if (rawpos<rawlen) {
+        out->len=(rawlen-rawpos<bufsize) ? rawlen-rawpos : bufsize;
+        memcpy(&out->data[0],&raw[rawpos],out->len);
+        rawpos+=out->len;
+      }
+      while ( (out->len<bufsize)&&(!raw_eof) ) {
+        const ssize_t res=read_input(&out->data[out->len],bufsize-out->len);
+        if (res==-2) { // stopped
+          return;
+        } else if (res<0) {
+          fail(strerror(errno));
+          return;
+        } else if (res==0) {
+          raw_eof=true;
+        }
+        out->len+=res;
+      }
+      end=(raw_eof)&&(rawpos==rawlen);
+    } else {
+      end=decode(*out);
+      if (!errmsg.empty()) {
+        return;
+      }
+    }
+    if (out->len) {
+      publish(out);
+    }
+    if (end) {
+      publish(NULL);
+      return;
+    }
+  }
+}
+// }}}
+
+// fills out (up to bufsize); true: end of (all concatenated) streams
+bool csv_zinput::decode(Buffer &out) // {{{
+{
+  while (out.len<bufsize) {
+    if ( (rawpos==rawlen)&&(!read_raw()) ) {
+      if (!errmsg.empty()) {
+        return true;
+      }
+      // eof: only valid between streams
+      if (fmt==Gzip) {
+        z_stream *z=(z_stream *)zs;
+        if (z->total_in) { // (inside a stream)
+          fail("unexpected end of compressed input");
+        }
+      }
+#ifdef CSV_HAVE_ZSTD
+      else if ( (fmt==Zstd)&&(zpending) ) {
+        fail("unexpected end of compressed input");
+      }
+#endif
+      return true;
+    }
+    if (fmt==Gzip) {
+      z_stream *z=(z_stream *)zs;
+      z->next_in=(Bytef *)&raw[rawpos];
+      z->avail_in=rawlen-rawpos;
+      z->next_out=(Bytef *)&out.data[out.len];
+      z->avail_out=bufsize-out.len;
+      const int res=inflate(z,Z_NO_FLUSH);
+      rawpos=rawlen-z->avail_in;
+      out.len=bufsize-z->avail_out;
+      if (res==Z_STREAM_END) { // (concatenated members: continue)
+        inflateReset(z);
+      } else if ( (res!=Z_OK)&&(res!=Z_BUF_ERROR) ) {
+        fail(z->msg);
+        return true;
+      }
+    }
+#ifdef CSV_HAVE_ZSTD
+    else if (fmt==Zstd) {
+      ZSTD_inBuffer in={&raw[rawpos],rawlen-rawpos,0};
+      ZSTD_outBuffer zout={&out.data[0],bufsize,out.len};
+      const size_t res=ZSTD_decompressStream((ZSTD_DStream *)zs,&zout,&in);
+      if (ZSTD_isError(res)) {
+        fail(ZSTD_getErrorName(res));
+        return true;
+      }
+      zpending=(res!=0);
+      rawpos+=in.pos;
+      out.len=zout.pos;
+    }
+#endif
+  }
+  return false;
+}
+// }}}
+
+void csv_zinput::close() // {{{
+{
+  if (!zs) {
+    return;
+  }
+  if (fmt==Gzip) {
+    inflateEnd((z_stream *)zs);
+    delete (z_stream *)zs;
+  }
+#ifdef CSV_HAVE_ZSTD
+  else if (fmt==Zstd) {
+    ZSTD_freeDStream((ZSTD_DStream *)zs);
+  }
+#endif
+  zs=NULL;
+}
+// }}}
+
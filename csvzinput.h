@@ -0,0 +1,80 @@
+#ifndef _CSVZINPUT_H
+#define _CSVZINPUT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+// Decompressing input stream: gzip (zlib), zstd (only with -DCSV_HAVE_ZSTD);
+// other input is passed through. The format is detected from the magic bytes.
+// A thread reads and decompresses into a ring of buffers, while the caller consumes them
+// (e.g. feeds them to a parser); it waits while all buffers are full (backpressure).
+//   csv_zinput in;
+//   in.open(fd);
+//   while (in.next(buf,len)) { parser(buf,len) ... }
+//   if (in.error()) ...
+class csv_zinput {
+  csv_zinput(const csv_zinput &); // = delete
+  csv_zinput &operator=(const csv_zinput &);
+public:
+  enum Format { Plain, Gzip, Zstd };
+
+  csv_zinput(size_t bufsize=1024*1024,int nbufs=4);
+  ~csv_zinput(); // (stops the thread, also while it waits for input; does not close fd)
+
+  // reads fd from its current position, until eof
+  // NOTE: returns true on error (errno)
+  bool open(int fd);
+
+  // next decompressed chunk (len>0); valid until the next call of next()
+  // false: end of input, or error
+  bool next(const char *&buf,size_t &len);
+
+  const char *error() const;
+  Format format() const { return fmt; } // (after the first next())
+
+  static Format detect(const unsigned char *buf,size_t len); // (at least 4 bytes, if available)
+
+private:
+  struct Buffer {
+    std::vector<char> data;
+    size_t len;
+  };
+  static void *thread_main(void *arg);
+  void produce();
+  Buffer *acquire();         // free buffer, NULL: stopped
+  void publish(Buffer *buf);
+  void fail(const char *msg);
+  ssize_t read_input(char *buf,size_t len); // read(); -1: error (errno), -2: stopped
+  bool read_raw();           // more raw input; false: eof, error or stopped
+  bool decode(Buffer &out);  // true: end of stream
+  void close();
+
+private:
+  size_t bufsize;
+  int fd;
+  Format fmt;
+
+  // producer side
+  std::vector<char> raw;
+  size_t rawpos,rawlen;
+  bool raw_eof;
+  void *zs;                  // z_stream / ZSTD_DStream
+  bool zpending;             // zstd: inside a frame
+
+  // ring: [tail,tail+filled) filled, in order; the consumer holds tail (if held)
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  std::vector<Buffer> ring;
+  int head,tail,filled;
+  bool held,done,stop;
+  std::string errmsg;        // (set before done)
+
+  bool started;
+  pthread_t tid;
+  int wake[2];               // pipe: the destructor interrupts a waiting read_input()
+};
+
+#endif
@@ -2,101 +2,302 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
+#include <errno.h>
+#include <string.h>
 #include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "csvwriter.h"
+#include "csvoutbuf.h"
+#include "csvthreads.h"
+#if __cplusplus>=201703L
+  #include <charconv>
+#endif
 
 namespace SimpleCSV {
 
-const std::string Row::del;
+// {{{ locale independent number parsing; the whole string must match
+static bool parse_int64(const char *buf,size_t len,int64_t &ret) // {{{
+{
+  const char *end=buf+len;
+  bool neg=false;
+  if ( (buf<end)&&((*buf=='-')||(*buf=='+')) ) {
+    neg=(*buf=='-');
+    buf++;
+  }
+  if (buf==end) {
+    return false;
+  }
+  const uint64_t limit=((uint64_t)-1>>1)+neg;
+  uint64_t val=0;
+  for (;buf<end;buf++) {
+    const unsigned int digit=(unsigned char)*buf-'0';
+    if (digit>9) {
+      return false;
+    } else if (val>(limit-digit)/10) { // overflow
+      return false;
+    }
+    val=val*10+digit;
+  }
+  ret=(neg) ? (int64_t)(0-val) : (int64_t)val;
+  return true;
+}
+// }}}
 
-Table empty_table;
-const Row Table::empty_row(empty_table,-1);
-const Value Table::empty_value(empty_row,-1,std::string());
+// decimal only, i.e. no nan / inf / hex floats (which from_chars / strtod would accept)
+// NOTE: buf must be NUL-terminated (for the strtod fallback)
+static bool parse_double(const char *buf,size_t len,double &ret) // {{{
+{
+  if ( (len>1)&&(*buf=='+')&&(buf[1]!='-') ) {
+    buf++;
+    len--;
+  }
+  bool digit=false;
+  for (size_t iA=0;iA<len;iA++) {
+    const char ch=buf[iA];
+    if ( (ch>='0')&&(ch<='9') ) {
+      digit=true;
+    } else if ( (ch!='.')&&(ch!='-')&&(ch!='+')&&(ch!='e')&&(ch!='E') ) {
+      return false;
+    }
+  }
+  if (!digit) {
+    return false;
+  }
+#ifdef __cpp_lib_to_chars
+  const std::from_chars_result res=std::from_chars(buf,buf+len,ret);
+  return (res.ec==std::errc())&&(res.ptr==buf+len);
+#else
+  // TODO: locale dependent decimal point
+  char *end;
+  errno=0;
+  ret=strtod(buf,&end);
+  return (end==buf+len)&&(errno!=ERANGE);
+#endif
+}
+// }}}
 
-// {{{ Value
-Value::Value(const Row &parent,int cidx,const std::string &value)
-  : parent(parent),
-    cidx(cidx),
-    value(value)
+static bool parse_bool(const char *buf,size_t len,bool &ret) // {{{
+{
+  static const char *const names[2]={"false","true"};
+  for (int iA=0;iA<2;iA++) {
+    if (len!=strlen(names[iA])) {
+      continue;
+    }
+    size_t iB=0;
+    for (;iB<len;iB++) {
+      if ((buf[iB]|0x20)!=names[iA][iB]) { // (ascii tolower)
+        break;
+      }
+    }
+    if (iB==len) {
+      ret=(iA==1);
+      return true;
+    }
+  }
+  return false;
+}
+// }}}
+
+static Type relax(Type type) // {{{
+{
+  return (type==Int64) ? Double : String;
+}
+// }}}
+// }}}
+
+// {{{ Arena
+Arena::Arena(size_t chunksize)
+  : chunksize(chunksize),
+    pos(NULL),end(NULL)
+{
+}
+
+Arena::~Arena()
 {
+  const int len=blocks.size();
+  for (int iA=0;iA<len;iA++) {
+    delete[] blocks[iA];
+  }
+}
+
+char *Arena::alloc_chunk(size_t size) // {{{
+{
+  char *ret=new char[size];
+  try {
+    blocks.push_back(ret);
+  } catch (...) {
+    delete[] ret;
+    throw;
+  }
+  return ret;
+}
+// }}}
+
+char *Arena::alloc(size_t size) // {{{
+{
+  if (size<=(size_t)(end-pos)) {
+    char *ret=pos;
+    pos+=size;
+    return ret;
+  } else if (size>chunksize/4) { // large: own chunk, keep current one
+    return alloc_chunk(size);
+  }
+  pos=alloc_chunk(chunksize);
+  end=pos+chunksize;
+  char *ret=pos;
+  pos+=size;
+  return ret;
+}
+// }}}
+
+const char *Arena::strdup(const char *buf,size_t len) // {{{
+{
+  char *ret=alloc(len+1);
+  memcpy(ret,buf,len);
+  ret[len]=0;
+  return ret;
 }
+// }}}
+// }}}
+
+const std::string Row::del;
 
+// {{{ Value
 int Value::asInt() const
 {
-  return atoi(value.c_str());  // TODO? error handling
+  const int64_t ret=asInt64();
+  return (ret<INT_MIN) ? INT_MIN : (ret>INT_MAX) ? INT_MAX : ret;
 }
 
-const char *Value::asCString() const
+int64_t Value::asInt64() const
+{
+  int64_t ret;
+  if (toInt64(ret)) {
+    return ret;
+  } else if ( (buf)&&(type==Double) ) {
+    return (num.d<=-9.2e18) ? INT64_MIN : (num.d>=9.2e18) ? INT64_MAX : (int64_t)num.d;
+  }
+  return strtoll(asCString(),NULL,10); // (like atoi: prefix, clamped)
+}
+
+double Value::asDouble() const
+{
+  double ret;
+  return (toDouble(ret)) ? ret : strtod(asCString(),NULL); // (like atof)
+}
+
+bool Value::asBool() const
 {
-  return value.c_str();
+  bool ret;
+  return (toBool(ret)) ? ret : false;
 }
 
-const std::string &Value::asString() const
+bool Value::toInt64(int64_t &ret) const // {{{
 {
-  return value;
+  if (!buf) {
+    return false;
+  } else if (type==Int64) {
+    ret=num.i;
+    return true;
+  }
+  return parse_int64(buf,len,ret);
 }
 // }}}
 
-// {{{ Row
-Row::Row(Table &parent,int ridx)
-  : parent(parent),ridx(ridx)
+bool Value::toDouble(double &ret) const // {{{
 {
+  if (!buf) {
+    return false;
+  } else if (type==Double) {
+    ret=num.d;
+    return true;
+  } else if (type==Int64) {
+    ret=num.i;
+    return true;
+  }
+  return parse_double(buf,len,ret);
 }
+// }}}
 
-Row::~Row()
+bool Value::toBool(bool &ret) const // {{{
 {
-  for (std::map<unsigned int,Value *>::iterator it=columns.begin(),end=columns.end();it!=end;++it) {
-    delete it->second;
+  if (!buf) {
+    return false;
+  } else if (type==Bool) {
+    ret=(num.i!=0);
+    return true;
   }
+  return parse_bool(buf,len,ret);
 }
+// }}}
+
+const char *Value::asCString() const
+{
+  return (buf) ? buf : "";
+}
+
+std::string Value::asString() const
+{
+  return (buf) ? std::string(buf,len) : std::string();
+}
+// }}}
 
+// {{{ Row
 // TODO
-const Value &Row::operator[](const char *key) const
+Value Row::operator[](const char *key) const
 {
-  int cidx=parent.find_column(key);
+  if (!parent) {
+    return Value(NULL,0);
+  }
+  int cidx=parent->find_column(key,strlen(key));
   if (cidx==-1) { // TODO?! throw   (or return none; [static const Value none;] ?)
     printf("Key \"%s\" not found\n",key);
   }
   return operator[](cidx);
 }
 
-const Value &Row::operator[](int cidx) const // {{{
+Value Row::operator[](int cidx) const // {{{
 {
   if ( (cidx<0)||(cidx>=size()) ) {
-    return parent.empty_value;
-  }
-  std::map<unsigned int,Value *>::const_iterator it=columns.find(cidx);
-  if (it==columns.end()) {
-    return parent.empty_value;
+    return Value(NULL,0);
   }
-  assert(it->second);
-  return *it->second;
+  return parent->get(slot,cidx);
 }
 // }}}
 
 int Row::size() const
 {
-  if (!columns.empty()) {  // columns.(r)begin()!=columns.(r)end()
-    return columns.rbegin()->first+1; // last existing key +1
-    //    "columns.back().first+1"
+  if (!parent) {
+    return 0;
   }
-  return 0;
-//  return parent.columnnames.size();
+  return parent->rowsize(slot);
 }
 
 void Row::set(int cidx,const std::string &value)
 {
+  assert(parent);
   if (&value==&del) {
-    columns.erase(cidx);
+    parent->del(slot,cidx);
+    return;
   }
-  Value *val=new Value(*this,cidx,value);
-  columns.insert(std::make_pair(cidx,val));
+  parent->set(slot,cidx,value.data(),value.size());
+}
+
+void Row::set(int cidx,const char *buf,int len)
+{
+  assert(parent);
+  parent->set(slot,cidx,buf,len);
 }
 
 void Row::dump() const // {{{
 {
   printf("[%d]:",ridx);
 
-//  for (std::map<unsigned int,Value *>::iterator it=columns.begin(),end=columns.end();it!=end;++it) {
   const int clen=size();
   for (int iA=0;iA<clen;iA++) {
     printf("%s;",operator[](iA).asCString());
@@ -110,12 +311,11 @@ void Row::write(csv_builder &out) const // {{{
   out.begin_row();
   const int clen=size();
   for (int iA=0;iA<clen;iA++) {
-    const Value &val=operator[](iA);
-    if (&val==&parent.empty_value) {
+    const Value val=operator[](iA);
+    if (val.isNull()) {
       out.cell(NULL,0);
     } else {
-      const std::string &str=val.asString(); 
-      out.cell(str.data(),str.size());
+      out.cell(val.buf,val.len);
     }
   }
   out.end_row();
@@ -125,127 +325,612 @@ void Row::write(csv_builder &out) const // {{{
 // }}}
 
 // {{{ Table
-Table::~Table()
-{
-  const int len=rows.size();
-  for (int iA=0;iA<len;iA++) {
-    delete rows[iA];
+struct Table::Snapshot { // {{{
+  Snapshot() : base(NULL),size(0),nrows(0),rowsizes(NULL) {}
+  ~Snapshot() {
+    if (base) {
+      munmap(base,size);
+    }
   }
+
+  struct Column {
+    const uint64_t *off;  // [slot], [slot+1] into blob; equal: NULL, else NUL-terminated cell
+    const char *blob;
+    const int64_t *i64;   // Int64, Bool
+    const double *dbl;    // Double
+  };
+  void *base;
+  size_t size;
+  size_t nrows;
+  const int32_t *rowsizes;
+  std::vector<Column> cols;
+};
+// }}}
+
+Table::~Table() // {{{
+{
+  delete snap;
 }
+// }}}
 
-const Row &Table::operator[](int ridx) const
+const Row Table::operator[](int ridx) const
 {
   if ( (ridx<0)||(ridx>=(int)size()) ) {
-    return empty_row;
+    return Row();
   }
-  return *rows[ridx];
+  return Row(const_cast<Table *>(this),ridx,slot_of(ridx));
 }
 
 int Table::size() const
 {
-  return rows.size();
+  return (snap) ? snap->nrows : rows.size()-ndead;
+}
+
+// pos of the live row ridx (ndead>0)
+size_t Table::select(int ridx) const // {{{
+{
+  const size_t n=rows.size();
+  size_t bit=1;
+  while (2*bit<=n) {
+    bit*=2;
+  }
+  size_t pos=0;
+  int rest=ridx+1;
+  for (;bit;bit/=2) {
+    if ( (pos+bit<=n)&&(live_tree[pos+bit]<rest) ) {
+      pos+=bit;
+      rest-=live_tree[pos];
+    }
+  }
+  return pos; // (1-based pos+1 has prefix sum ridx+1)
+}
+// }}}
+
+void Table::kill(size_t pos) // {{{
+{
+  if (!ndead) {
+    dead.assign(rows.size(),0);
+    build_tree();
+  }
+  dead[pos]=1;
+  ndead++;
+  for (size_t iA=pos+1;iA<=rows.size();iA+=iA&(~iA+1)) {
+    live_tree[iA]--;
+  }
+}
+// }}}
+
+// O(n), from dead
+void Table::build_tree() const // {{{
+{
+  const size_t n=rows.size();
+  live_tree.assign(n+1,0);
+  for (size_t iA=1;iA<=n;iA++) {
+    live_tree[iA]+=!dead[iA-1];
+    const size_t up=iA+(iA&(~iA+1));
+    if (up<=n) {
+      live_tree[up]+=live_tree[iA];
+    }
+  }
+}
+// }}}
+
+// new last pos; keeps tombstones (O(log n))
+void Table::append_row(size_t slot) // {{{
+{
+  rows.push_back(slot);
+  if (!ndead) {
+    return;
+  }
+  dead.push_back(0);
+  const size_t n=rows.size(),low=n&(~n+1);
+  int sum=1;
+  for (size_t iA=n-1;iA>n-low;iA-=iA&(~iA+1)) { // (children of node n)
+    sum+=live_tree[iA];
+  }
+  live_tree.push_back(sum);
+}
+// }}}
+
+void Table::compact() const // {{{
+{
+  if (!ndead) {
+    return;
+  }
+  size_t out=0;
+  for (size_t iA=0;iA<rows.size();iA++) {
+    if (!dead[iA]) {
+      rows[out++]=rows[iA];
+    }
+  }
+  rows.resize(out);
+  ndead=0;
+  std::vector<char>().swap(dead);
+  std::vector<int>().swap(live_tree);
+}
+// }}}
+
+void Table::pop_row() // {{{
+{
+  assert(!rows.empty());
+  const size_t slot=rows.back();
+  rows.pop_back();
+  if (ndead) { // (last pos is live: the tree's other nodes do not cover it)
+    assert(!dead.back());
+    dead.pop_back();
+    live_tree.pop_back();
+  }
+  slot2ridx_stale=true;
+  if (slot+1!=rowsizes.size()) {
+    return;
+  }
+  rowsizes.pop_back();
+  for (size_t iA=0;iA<columns.size();iA++) {
+    ColumnData &col=columns[iA];
+    if (col.null.size()>slot) {
+      col.str.resize(slot);
+      col.len.resize(slot);
+      col.null.resize(slot);
+      if (col.i64.size()>slot) {
+        col.i64.resize(slot);
+      }
+      if (col.dbl.size()>slot) {
+        col.dbl.resize(slot);
+      }
+      stale_index(iA);
+    }
+  }
 }
+// }}}
 
 void Table::dump() const // {{{
 {
-  const int clen=size();
+  const int clen=columnnames.size();
   for (int iA=0;iA<clen;iA++) {
-    printf("%s;",columnnames[iA]->c_str());
+    printf("%s;",columnnames[iA].c_str());
   }
   printf("\n---\n");
 
   const int len=size();
   for (int iA=0;iA<len;iA++) {
     (operator[])(iA).dump();
-//    rows[iA]->dump();
   }
 }
 // }}}
 
-int Table::find_column(const std::string &name) const // {{{
+static inline unsigned char fold(char ch) // {{{
+{
+  return ( (ch>='A')&&(ch<='Z') ) ? ch-'A'+'a' : ch;
+}
+// }}}
+
+static unsigned int hash_nocase(const char *buf,size_t len) // {{{
+{
+  unsigned int ret=2166136261u; // FNV-1a
+  for (size_t iA=0;iA<len;iA++) {
+    ret=(ret^fold(buf[iA]))*16777619u;
+  }
+  return ret;
+}
+// }}}
+
+static bool eq_nocase(const std::string &a,const char *buf,size_t len) // {{{
+{
+  if (a.size()!=len) {
+    return false;
+  }
+  for (size_t iA=0;iA<len;iA++) {
+    if (fold(a[iA])!=fold(buf[iA])) {
+      return false;
+    }
+  }
+  return true;
+}
+// }}}
+
+int Table::find_column(const char *name,size_t len) const // {{{
 {
-  std::multimap<std::string,int>::const_iterator it=rev_column.find(name);
-  if (it==rev_column.end()) {
+  if (name_index.empty()) {
     return -1;
   }
-  return it->second; // only first matching element
+  const size_t mask=name_index.size()-1;
+  for (size_t pos=hash_nocase(name,len)&mask;name_index[pos];pos=(pos+1)&mask) {
+    const int cidx=name_index[pos]-1;
+    if (eq_nocase(columnnames[cidx],name,len)) {
+      return cidx;
+    }
+  }
+  return -1;
+}
+// }}}
+
+Column Table::column(const char *name) const // {{{
+{
+  return Column(find_column(name,strlen(name)));
+}
+// }}}
+
+Column Table::column(const std::string &name) const // {{{
+{
+  return Column(find_column(name));
+}
+// }}}
+
+size_t Table::newSlot() // {{{
+{
+  rowsizes.push_back(0);
+  return rowsizes.size()-1;
+}
+// }}}
+
+size_t Table::nslots() const // {{{
+{
+  return (snap) ? snap->nrows : rowsizes.size();
+}
+// }}}
+
+int Table::rowsize(size_t slot) const // {{{
+{
+  return (snap) ? snap->rowsizes[slot] : rowsizes[slot];
+}
+// }}}
+
+void Table::writable() const // {{{
+{
+  if (snap) {
+    throw std::logic_error("Table is a read-only snapshot");
+  }
+}
+// }}}
+
+Value Table::get(size_t slot,int cidx) const // {{{
+{
+  if (cidx>=(int)columns.size()) {
+    return Value(NULL,0);
+  } else if (snap) {
+    const Snapshot::Column &col=snap->cols[cidx];
+    const uint64_t off=col.off[slot],end=col.off[slot+1];
+    if (off==end) {
+      return Value(NULL,0);
+    }
+    Value ret(col.blob+off,end-off-1);
+    ret.type=columns[cidx].type;
+    if (ret.type==Double) {
+      ret.num.d=col.dbl[slot];
+    } else if (ret.type!=String) {
+      ret.num.i=col.i64[slot];
+    }
+    return ret;
+  }
+  const ColumnData &col=columns[cidx];
+  if ( (slot>=col.null.size())||(col.null[slot]) ) {
+    return Value(NULL,0);
+  }
+  Value ret(col.str[slot],col.len[slot]);
+  ret.type=col.type;
+  if (col.type==Double) {
+    ret.num.d=col.dbl[slot];
+  } else if (col.type!=String) {
+    ret.num.i=col.i64[slot];
+  }
+  return ret;
+}
+// }}}
+
+void Table::set(size_t slot,int cidx,const char *buf,int len) // {{{
+{
+  writable();
+  assert( (cidx>=0)&&(slot<rowsizes.size()) );
+  if (cidx>=(int)columns.size()) {
+    columns.resize(cidx+1);
+  }
+  stale_index(cidx);
+  ColumnData &col=columns[cidx];
+  if (slot>=col.null.size()) {
+    col.str.resize(slot+1,(const char *)NULL);
+    col.len.resize(slot+1,0);
+    col.null.resize(slot+1,true);
+    if (col.type==Double) {
+      col.dbl.resize(slot+1,0.0);
+    } else if (col.type!=String) {
+      col.i64.resize(slot+1,0);
+    }
+  }
+  if (!buf) {
+    col.null[slot]=true;
+    col.len[slot]=0;
+  } else { // (old content stays in arena)
+    const char *str=arena.strdup(buf,len);
+    col.str[slot]=str;
+    col.len[slot]=len;
+    col.null[slot]=false;
+
+    bool ok=true, bval=false;
+    switch (col.type) {
+    case String: break;
+    case Int64:  ok=parse_int64(str,len,col.i64[slot]); break;
+    case Double: ok=parse_double(str,len,col.dbl[slot]); break;
+    case Bool:   ok=parse_bool(str,len,bval); col.i64[slot]=bval; break;
+    }
+    if (!ok) {
+      IBuild::setType(*this,cidx,relax(col.type));
+    }
+  }
+  if (cidx>=rowsizes[slot]) {
+    rowsizes[slot]=cidx+1;
+  }
+}
+// }}}
+
+void Table::del(size_t slot,int cidx) // {{{
+{
+  writable();
+  assert(slot<rowsizes.size());
+  if ( (cidx<0)||(cidx>=rowsizes[slot]) ) {
+    return;
+  }
+  ColumnData &col=columns[cidx];
+  if (slot<col.null.size()) {
+    col.null[slot]=true;
+    col.len[slot]=0;
+  }
+  stale_index(cidx);
+  if (cidx==rowsizes[slot]-1) { // shrink to last existing cell
+    int &rsize=rowsizes[slot];
+    while ( (rsize>0)&&(get(slot,rsize-1).isNull()) ) {
+      rsize--;
+    }
+  }
+}
+// }}}
+
+bool Table::convert(ColumnData &col,Type type) // {{{
+{
+  const size_t len=col.null.size();
+  std::vector<int64_t> i64;
+  std::vector<double> dbl;
+  if (type==Double) {
+    dbl.resize(len,0.0);
+  } else if (type!=String) {
+    i64.resize(len,0);
+  }
+  for (size_t iA=0;iA<len;iA++) {
+    if (col.null[iA]) {
+      continue;
+    }
+    bool ok=true, bval=false;
+    switch (type) {
+    case String: break;
+    case Int64:  ok=parse_int64(col.str[iA],col.len[iA],i64[iA]); break;
+    case Double: ok=parse_double(col.str[iA],col.len[iA],dbl[iA]); break;
+    case Bool:   ok=parse_bool(col.str[iA],col.len[iA],bval); i64[iA]=bval; break;
+    }
+    if (!ok) {
+      return false;
+    }
+  }
+  col.type=type;
+  col.i64.swap(i64);
+  col.dbl.swap(dbl);
+  return true;
 }
 // }}}
 
-// TODO? allow rows[]==NULL  for empty_row  (created by after-the-end insertRow)
+Type Table::type(int cidx) const // {{{
+{
+  if ( (cidx<0)||(cidx>=(int)columns.size()) ) {
+    return String;
+  }
+  return columns[cidx].type;
+}
+// }}}
 
 Row &Table::IBuild::newRow(Table &csv) // {{{
 {
-  csv.rows.push_back(new Row(csv,csv.rows.size()));
-  return *csv.rows.back();
+  csv.writable();
+  const size_t slot=csv.newSlot();
+  csv.append_row(slot);
+  csv.slot2ridx_stale=true;
+  csv.built=Row(&csv,csv.size()-1,slot);
+  return csv.built;
 }
 // }}}
 
 Row &Table::IBuild::insertRow(Table &csv,int at_ridx) // {{{
 {
+  csv.writable();
   if (at_ridx<0) {
     throw std::invalid_argument("bad ridx");
   }
-  if (at_ridx<(int)csv.rows.size()) { // insert
-    Row *ret=new Row(csv,at_ridx);
-/* replace
-    delete csv.rows[at_ridx];
-    csv.rows[at_ridx]=ret;
-*/
-    std::vector<Row *>::iterator it=csv.rows.begin();
-    std::advance(it,at_ridx);
-    try {
-      it=++csv.rows.insert(it,ret);
-    } catch (...) {
-      delete ret;
-      throw;
-    }
-
-    // fix Row::ridx 
-    std::vector<Row *>::iterator end=csv.rows.end();
-    for (;it!=end;++it) {
-      (*it)->ridx++;
+  csv.slot2ridx_stale=true;
+  if (at_ridx<csv.size()) { // insert
+    const size_t slot=csv.newSlot();
+    if (!csv.ndead) {
+      std::vector<size_t>::iterator it=csv.rows.begin();
+      std::advance(it,at_ridx);
+      csv.rows.insert(it,slot);
+      csv.built=Row(&csv,at_ridx,slot);
+      return csv.built;
+    }
+    const size_t pos=csv.select(at_ridx);
+    if ( (pos>0)&&(csv.dead[pos-1]) ) { // reuse the tombstone just before: O(log n)
+      csv.rows[pos-1]=slot;
+      csv.dead[pos-1]=0;
+      csv.ndead--;
+      for (size_t iA=pos;iA<=csv.rows.size();iA+=iA&(~iA+1)) { // (1-based pos-1)
+        csv.live_tree[iA]++;
+      }
+      if (!csv.ndead) {
+        std::vector<char>().swap(csv.dead);
+        std::vector<int>().swap(csv.live_tree);
+      }
+    } else { // shift: O(n)
+      csv.rows.insert(csv.rows.begin()+pos,slot);
+      csv.dead.insert(csv.dead.begin()+pos,0);
+      csv.build_tree();
     }
-    return *ret;
+    csv.built=Row(&csv,at_ridx,slot);
+    return csv.built;
   } else { // append
-    csv.rows.reserve(at_ridx+1);
-    for (int iA=csv.rows.size();iA<=at_ridx;iA++) {
-      csv.rows.push_back(new Row(csv,iA));
+    for (int iA=csv.size();iA<=at_ridx;iA++) {
+      csv.append_row(csv.newSlot());
     }
-    return *csv.rows.back();
+    csv.built=Row(&csv,at_ridx,csv.rows.back());
+    return csv.built;
   }
 }
 // }}}
 
 void Table::IBuild::deleteRow(Table &csv,int ridx) // {{{
 {
-  if ( (ridx<0)||(ridx>=(int)csv.rows.size()) ) {
+  csv.writable();
+  if ( (ridx<0)||(ridx>=csv.size()) ) {
     return; // no-op   (TODO?)
   }
-  delete csv.rows[ridx];
-  std::vector<Row *>::iterator it=csv.rows.begin();
-  std::advance(it,ridx);
-  it=csv.rows.erase(it);
+  // (slot storage is not reclaimed)
+  csv.kill((csv.ndead) ? csv.select(ridx) : ridx);
+  csv.slot2ridx_stale=true;
+  if (csv.ndead>csv.rows.size()/2) {
+    csv.compact();
+  }
+}
+// }}}
+
+void Table::IBuild::insertRows(Table &csv,const std::vector<int> &at_ridxs,std::vector<Row> &ret) // {{{
+{
+  csv.writable();
+  csv.compact();
+  const size_t len=csv.rows.size(),count=at_ridxs.size();
+  for (size_t iA=0;iA<count;iA++) {
+    if ( (at_ridxs[iA]<0)||(at_ridxs[iA]>(int)len)||( (iA>0)&&(at_ridxs[iA]<at_ridxs[iA-1]) ) ) {
+      throw std::invalid_argument("bad ridx");
+    }
+  }
+  csv.slot2ridx_stale=true;
+  ret.clear();
+  ret.reserve(count);
+
+  // from the back, in place
+  csv.rows.resize(len+count);
+  size_t src=len,dst=len+count;
+  for (size_t iA=count;iA>0;iA--) {
+    const size_t at=at_ridxs[iA-1];
+    while (src>at) {
+      csv.rows[--dst]=csv.rows[--src];
+    }
+    csv.rows[--dst]=csv.newSlot();
+  }
+  for (size_t iA=0;iA<count;iA++) {
+    const int ridx=at_ridxs[iA]+iA;
+    ret.push_back(Row(&csv,ridx,csv.rows[ridx]));
+  }
+}
+// }}}
 
-  // fix Row::ridx
-  std::vector<Row *>::iterator end=csv.rows.end();
-  for (;it!=end;++it) {
-    (*it)->ridx--;
+void Table::IBuild::deleteRows(Table &csv,const std::vector<int> &ridxs) // {{{
+{
+  csv.writable();
+  csv.compact();
+  const size_t len=csv.rows.size();
+  std::vector<char> del(len,0);
+  for (size_t iA=0;iA<ridxs.size();iA++) {
+    if ( (ridxs[iA]>=0)&&(ridxs[iA]<(int)len) ) {
+      del[ridxs[iA]]=1;
+    }
+  }
+  size_t out=0;
+  for (size_t iA=0;iA<len;iA++) {
+    if (!del[iA]) {
+      csv.rows[out++]=csv.rows[iA];
+    }
   }
+  csv.rows.resize(out);
+  csv.slot2ridx_stale=true;
 }
 // }}}
 
 // TODO? throw instead at duplicate?
 void Table::IBuild::setHeader(Table &csv,const std::vector<std::string>& names) // {{{
 {
-  csv.columnnames.clear();
-  csv.rev_column.clear();
+  csv.writable();
+  csv.columnnames=names;
 
+  // load factor <= 1/2
   const int len=names.size();
-  csv.columnnames.reserve(len);
+  size_t size=(len) ? 4 : 0;
+  while (size<2*(size_t)len) {
+    size*=2;
+  }
+  csv.name_index.assign(size,0);
   for (int iA=0;iA<len;iA++) {
-    std::multimap<std::string,int>::iterator it=csv.rev_column.insert(std::make_pair(names[iA],iA));
-    csv.columnnames.push_back(&it->first);
+    if (csv.find_column(names[iA])>=0) { // duplicate: first one wins
+      continue;
+    }
+    const size_t mask=size-1;
+    size_t pos=hash_nocase(names[iA].data(),names[iA].size())&mask;
+    while (csv.name_index[pos]) {
+      pos=(pos+1)&mask;
+    }
+    csv.name_index[pos]=iA+1;
+  }
+}
+// }}}
+
+void Table::IBuild::setType(Table &csv,int cidx,Type type) // {{{
+{
+  csv.writable();
+  if (cidx<0) {
+    throw std::invalid_argument("bad cidx");
+  } else if (cidx>=(int)csv.columns.size()) {
+    csv.columns.resize(cidx+1);
+  }
+  ColumnData &col=csv.columns[cidx];
+  while (!csv.convert(col,type)) {
+    type=relax(type);
+  }
+  csv.stale_index(cidx);
+}
+// }}}
+
+void Table::IBuild::inferTypes(Table &csv,int sample_rows) // {{{
+{
+  const int len=(sample_rows<csv.size()) ? sample_rows : csv.size();
+  const int clen=csv.columns.size();
+  for (int iA=0;iA<clen;iA++) {
+    const ColumnData &col=csv.columns[iA];
+    unsigned int candidates=(1<<Int64)|(1<<Double)|(1<<Bool);
+    bool seen=false;
+    for (int iB=0;(iB<len)&&(candidates);iB++) {
+      const size_t slot=csv.slot_of(iB);
+      if ( (slot>=col.null.size())||(col.null[slot]) ) {
+        continue;
+      }
+      seen=true;
+      const char *str=col.str[slot];
+      int64_t ival;
+      double dval;
+      bool bval;
+      if ( (candidates&(1<<Int64))&&(!parse_int64(str,col.len[slot],ival)) ) {
+        candidates&=~(1<<Int64);
+      }
+      if ( (candidates&(1<<Double))&&(!parse_double(str,col.len[slot],dval)) ) {
+        candidates&=~(1<<Double);
+      }
+      if ( (candidates&(1<<Bool))&&(!parse_bool(str,col.len[slot],bval)) ) {
+        candidates&=~(1<<Bool);
+      }
+    }
+
+    Type type=String;
+    if (!seen) {
+    } else if (candidates&(1<<Bool)) {
+      type=Bool;
+    } else if (candidates&(1<<Int64)) {
+      type=Int64;
+    } else if (candidates&(1<<Double)) {
+      type=Double;
+    }
+    setType(csv,iA,type);
   }
 }
 // }}}
@@ -254,10 +939,10 @@ void Table::write(csv_builder &out,bool with_header) const // {{{
 {
   if (with_header) {
     out.begin_row();
-    const int clen=size();
+    const int clen=columnnames.size();
     for (int iA=0;iA<clen;iA++) {
-      out.cell(columnnames[iA]->c_str(),
-               columnnames[iA]->size());
+      out.cell(columnnames[iA].data(),
+               columnnames[iA].size());
     }
     out.end_row();
   }
@@ -271,36 +956,789 @@ void Table::write(csv_builder &out,bool with_header) const // {{{
 
 // }}}
 
+// {{{ Table::write_parallel
+struct Table::WriteJob { // {{{
+  typedef csv_writer<csv_outbuf> writer;
+  WriteJob(const Table &tbl,int chunk_rows) : tbl(tbl),chunk_rows(chunk_rows),first(0) {}
 
-builder::builder(Table &result,bool first_is_header) // {{{
-  : result(result),
-    row(NULL),
+  static void task(void *ctx,int idx) {
+    WriteJob &job=*(WriteJob *)ctx;
+    writer &wr=*job.writers[idx];
+    wr.output().clear();
+    const int start=job.first+idx*job.chunk_rows,
+              end=(start+job.chunk_rows<job.tbl.size()) ? start+job.chunk_rows : job.tbl.size();
+    for (int iA=start;iA<end;iA++) {
+      job.tbl[iA].write(wr);
+    }
+  }
+
+  const Table &tbl;
+  int chunk_rows;
+  int first;  // of the current round
+  std::vector<writer *> writers; // [chunk of round]
+};
+// }}}
+
+static const int write_chunk_rows=8192;
+
+bool Table::write_parallel(csv_outbuf &out,bool with_header,int threads, // {{{
+                           char qchar,char sep,bool smart_quote) const
+{
+  compact(); // (read-only from here)
+  threads=csv_threads(threads);
+  if (with_header) {
+    csv_writer<csv_outbuf &> wr(out,qchar,sep,smart_quote);
+    wr.begin_row();
+    for (size_t iA=0;iA<columnnames.size();iA++) {
+      wr.cell(columnnames[iA].data(),columnnames[iA].size());
+    }
+    wr.end_row();
+  }
+
+  // rounds of 2*threads chunks: bounded memory
+  WriteJob job(*this,write_chunk_rows);
+  const int nchunks=(threads>1) ? 2*threads : 1;
+  for (int iA=0;iA<nchunks;iA++) {
+    job.writers.push_back(new WriteJob::writer(qchar,sep,smart_quote));
+  }
+  const int len=size();
+  for (;job.first<len;job.first+=nchunks*job.chunk_rows) {
+    const int left=(len-job.first+job.chunk_rows-1)/job.chunk_rows;
+    const int count=(left<nchunks) ? left : nchunks;
+    csv_parallel_for pf(&WriteJob::task,&job,count);
+    pf.run(threads);
+
+    for (int iB=0;iB<count;iB++) {
+      const csv_outbuf &buf=job.writers[iB]->output();
+      out(buf.data(),buf.size());
+    }
+  }
+  for (int iA=0;iA<nchunks;iA++) {
+    delete job.writers[iA];
+  }
+  return out.failed();
+}
+// }}}
+
+// }}}
+
+// {{{ Table snapshot
+// Layout (host byte order, all sections 8-byte aligned):
+//   SnapHeader, names (uint32 len + bytes each), rowsizes (int32[nrows]), SnapColumn[ncols],
+//   per column: offsets (uint64[nrows+1] into blob), native values (int64/double[nrows], typed
+//   columns only), blob (cells incl. NUL; NULL cells take no bytes)
+namespace {
+
+const char snap_magic[8]={'S','C','S','V','S','N','A','P'};
+const uint32_t snap_version=1,snap_byteorder=0x01020304;
+
+struct SnapHeader {
+  char magic[8];
+  uint32_t version,byteorder;
+  uint64_t nrows,ncols,nnames;
+  uint64_t names_off,rowsizes_off,columns_off;
+  uint64_t file_size;
+};
+
+struct SnapColumn {
+  uint32_t type,pad;
+  uint64_t off_off,num_off,blob_off,blob_len;
+};
+
+inline uint64_t pad8(uint64_t len) { return (len+7)&~(uint64_t)7; }
+
+} // namespace
+
+bool Table::saveSnapshot(const char *filename) const // {{{
+{
+  compact();
+  const size_t nrows=size(),ncols=columns.size();
+
+  SnapHeader hdr;
+  memset(&hdr,0,sizeof(hdr));
+  memcpy(hdr.magic,snap_magic,sizeof(hdr.magic));
+  hdr.version=snap_version;
+  hdr.byteorder=snap_byteorder;
+  hdr.nrows=nrows;
+  hdr.ncols=ncols;
+  hdr.nnames=columnnames.size();
+
+  uint64_t pos=sizeof(hdr);
+  hdr.names_off=pos;
+  for (size_t iA=0;iA<columnnames.size();iA++) {
+    pos+=sizeof(uint32_t)+columnnames[iA].size();
+  }
+  pos=pad8(pos);
+  hdr.rowsizes_off=pos;
+  pos=pad8(pos+nrows*sizeof(int32_t));
+  hdr.columns_off=pos;
+  pos+=ncols*sizeof(SnapColumn);
+
+  std::vector<SnapColumn> cols(ncols);
+  for (size_t iA=0;iA<ncols;iA++) {
+    SnapColumn &col=cols[iA];
+    col.type=columns[iA].type;
+    col.pad=0;
+    col.off_off=pos;
+    pos+=(nrows+1)*sizeof(uint64_t);
+    if (col.type!=String) {
+      col.num_off=pos;
+      pos+=nrows*sizeof(uint64_t);
+    } else {
+      col.num_off=0;
+    }
+    col.blob_off=pos;
+    col.blob_len=0;
+    for (size_t iB=0;iB<nrows;iB++) {
+      const Value val=get(slot_of(iB),iA);
+      if (!val.isNull()) {
+        col.blob_len+=val.len+1;
+      }
+    }
+    pos=pad8(pos+col.blob_len);
+  }
+  hdr.file_size=pos;
+
+  FILE *f=fopen(filename,"wb");
+  if (!f) {
+    return true;
+  }
+  static const char zeros[8]={0};
+  bool ok=(fwrite(&hdr,sizeof(hdr),1,f)==1);
+  uint64_t written=sizeof(hdr);
+  for (size_t iA=0;iA<columnnames.size();iA++) {
+    const uint32_t len=columnnames[iA].size();
+    ok=(ok)&&(fwrite(&len,sizeof(len),1,f)==1)&&(fwrite(columnnames[iA].data(),1,len,f)==len);
+    written+=sizeof(len)+len;
+  }
+  ok=(ok)&&(fwrite(zeros,1,hdr.rowsizes_off-written,f)==hdr.rowsizes_off-written);
+  for (size_t iB=0;(ok)&&(iB<nrows);iB++) {
+    const int32_t rsize=rowsize(slot_of(iB));
+    ok=(fwrite(&rsize,sizeof(rsize),1,f)==1);
+  }
+  written=hdr.rowsizes_off+nrows*sizeof(int32_t);
+  ok=(ok)&&(fwrite(zeros,1,hdr.columns_off-written,f)==hdr.columns_off-written);
+  ok=(ok)&&( (ncols==0)||(fwrite(&cols[0],sizeof(SnapColumn),ncols,f)==ncols) );
+
+  for (size_t iA=0;(ok)&&(iA<ncols);iA++) {
+    uint64_t off=0;
+    ok=(fwrite(&off,sizeof(off),1,f)==1);
+    for (size_t iB=0;(ok)&&(iB<nrows);iB++) {
+      const Value val=get(slot_of(iB),iA);
+      if (!val.isNull()) {
+        off+=val.len+1;
+      }
+      ok=(fwrite(&off,sizeof(off),1,f)==1);
+    }
+    for (size_t iB=0;(ok)&&(cols[iA].num_off)&&(iB<nrows);iB++) {
+      const Value val=get(slot_of(iB),iA);
+      int64_t num=0;
+      if (!val.isNull()) {
+        memcpy(&num,&val.num,sizeof(num)); // (i or d)
+      }
+      ok=(fwrite(&num,sizeof(num),1,f)==1);
+    }
+    for (size_t iB=0;(ok)&&(iB<nrows);iB++) {
+      const Value val=get(slot_of(iB),iA);
+      if (!val.isNull()) {
+        ok=(fwrite(val.buf,1,val.len+1,f)==val.len+1);
+      }
+    }
+    const uint64_t end=cols[iA].blob_off+cols[iA].blob_len;
+    ok=(ok)&&(fwrite(zeros,1,pad8(end)-end,f)==pad8(end)-end);
+  }
+  if (fclose(f)!=0) {
+    return true;
+  }
+  return !ok;
+}
+// }}}
+
+bool Table::IBuild::loadSnapshot(Table &csv,const char *filename) // {{{
+{
+  if ( (csv.size())||(csv.snap)||(!csv.columns.empty()) ) {
+    throw std::invalid_argument("loadSnapshot: Table not empty");
+  }
+  const int fd=open(filename,O_RDONLY);
+  if (fd<0) {
+    return true;
+  }
+  struct stat st;
+  if (fstat(fd,&st)<0) {
+    close(fd);
+    return true;
+  }
+  Snapshot *snap=new Snapshot;
+  snap->size=st.st_size;
+  if (snap->size>=sizeof(SnapHeader)) {
+    snap->base=mmap(NULL,snap->size,PROT_READ,MAP_PRIVATE,fd,0);
+    if (snap->base==MAP_FAILED) {
+      snap->base=NULL;
+      const int err=errno;
+      close(fd);
+      delete snap;
+      errno=err;
+      return true;
+    }
+  }
+  close(fd);
+
+  // validate
+  const char *base=(const char *)snap->base;
+  const uint64_t size=snap->size;
+  SnapHeader hdr;
+  bool ok=(base!=NULL);
+  if (ok) {
+    memcpy(&hdr,base,sizeof(hdr));
+    ok=(memcmp(hdr.magic,snap_magic,sizeof(hdr.magic))==0)&&
+       (hdr.version==snap_version)&&(hdr.byteorder==snap_byteorder)&&
+       (hdr.file_size==size)&&(hdr.nrows<(1u<<31))&&
+       (hdr.names_off<=size)&&
+       (hdr.rowsizes_off%8==0)&&(hdr.rowsizes_off+hdr.nrows*sizeof(int32_t)<=size)&&
+       (hdr.columns_off%8==0)&&(hdr.ncols<=size/sizeof(SnapColumn))&&
+       (hdr.columns_off+hdr.ncols*sizeof(SnapColumn)<=size);
+  }
+  std::vector<std::string> names;
+  for (uint64_t iA=0,pos=hdr.names_off;(ok)&&(iA<hdr.nnames);iA++) {
+    uint32_t len;
+    ok=(pos+sizeof(len)<=size);
+    if (ok) {
+      memcpy(&len,base+pos,sizeof(len));
+      pos+=sizeof(len);
+      ok=(pos+len<=size);
+    }
+    if (ok) {
+      names.push_back(std::string(base+pos,len));
+      pos+=len;
+    }
+  }
+  const uint64_t nrows=(ok) ? hdr.nrows : 0;
+  for (uint64_t iA=0;(ok)&&(iA<hdr.ncols);iA++) {
+    const SnapColumn &col=((const SnapColumn *)(base+hdr.columns_off))[iA];
+    ok=(col.type<=Bool)&&
+       (col.off_off%8==0)&&(col.off_off+(nrows+1)*sizeof(uint64_t)<=size)&&
+       ( (col.type==String)||( (col.num_off%8==0)&&(col.num_off+nrows*sizeof(uint64_t)<=size) ) )&&
+       (col.blob_off<=size)&&(col.blob_len<=size-col.blob_off);
+    if (!ok) {
+      break;
+    }
+    Snapshot::Column scol;
+    scol.off=(const uint64_t *)(base+col.off_off);
+    scol.blob=base+col.blob_off;
+    scol.i64=(col.type==String) ? NULL : (const int64_t *)(base+col.num_off);
+    scol.dbl=(col.type==String) ? NULL : (const double *)(base+col.num_off);
+    // cell offsets: ascending up to blob_len, cells NUL-terminated
+    ok=(scol.off[0]==0)&&(scol.off[nrows]==col.blob_len);
+    for (uint64_t iB=0;(ok)&&(iB<nrows);iB++) {
+      const uint64_t off=scol.off[iB],end=scol.off[iB+1];
+      ok=(off<=end)&&(end<=col.blob_len)&&( (off==end)||(scol.blob[end-1]=='\0') );
+    }
+    snap->cols.push_back(scol);
+  }
+  if (!ok) {
+    delete snap;
+    errno=EINVAL;
+    return true;
+  }
+
+  setHeader(csv,names);
+  csv.columns.resize(hdr.ncols);
+  for (uint64_t iA=0;iA<hdr.ncols;iA++) {
+    csv.columns[iA].type=(Type)((const SnapColumn *)(base+hdr.columns_off))[iA].type;
+  }
+  snap->nrows=nrows;
+  snap->rowsizes=(const int32_t *)(base+hdr.rowsizes_off);
+  csv.snap=snap;
+  csv.slot2ridx_stale=true;
+  return false;
+}
+// }}}
+
+// }}}
+
+// {{{ Table indexes
+static unsigned int hash_bytes(const char *buf,size_t len) // {{{
+{
+  unsigned int ret=2166136261u; // FNV-1a
+  for (size_t iA=0;iA<len;iA++) {
+    ret=(ret^(unsigned char)buf[iA])*16777619u;
+  }
+  return ret;
+}
+// }}}
+
+bool Table::cell_text(size_t slot,int cidx,const char *&buf,unsigned int &len) const // {{{
+{
+  if ( (cidx<0)||(cidx>=(int)columns.size()) ) {
+    return false;
+  } else if (snap) {
+    const Value val=get(slot,cidx);
+    buf=val.buf;
+    len=val.len;
+    return (buf!=NULL);
+  }
+  const ColumnData &col=columns[cidx];
+  if ( (slot>=col.null.size())||(col.null[slot]) ) {
+    return false;
+  }
+  buf=col.str[slot];
+  len=col.len[slot];
+  return true;
+}
+// }}}
+
+// (cell must not be NULL)
+Table::Key Table::cell_key(size_t slot,int cidx) const // {{{
+{
+  Key ret;
+  if (snap) {
+    const Value val=get(slot,cidx);
+    ret.buf=val.buf;
+    ret.len=val.len;
+    ret.i=(val.type==Int64)||(val.type==Bool) ? val.num.i : 0;
+    ret.d=(val.type==Double) ? val.num.d : 0.0;
+    return ret;
+  }
+  const ColumnData &col=columns[cidx];
+  ret.buf=col.str[slot];
+  ret.len=col.len[slot];
+  ret.i=(col.type==Int64)||(col.type==Bool) ? col.i64[slot] : 0;
+  ret.d=(col.type==Double) ? col.dbl[slot] : 0.0;
+  return ret;
+}
+// }}}
+
+int Table::compare(Type type,const Key &a,const Key &b) // {{{
+{
+  switch (type) {
+  case Int64:
+  case Bool:
+    return (a.i<b.i) ? -1 : (a.i>b.i);
+  case Double:
+    return (a.d<b.d) ? -1 : (a.d>b.d);
+  case String:
+    break;
+  }
+  const int res=memcmp(a.buf,b.buf,(a.len<b.len) ? a.len : b.len);
+  if (res) {
+    return res;
+  }
+  return (a.len<b.len) ? -1 : (a.len>b.len);
+}
+// }}}
+
+struct Table::slot_less { // {{{
+  slot_less(const Table &tbl,int cidx) : tbl(tbl),cidx(cidx),type(tbl.type(cidx)) {}
+
+  bool operator()(size_t a,size_t b) const {
+    const int res=compare(type,tbl.cell_key(a,cidx),tbl.cell_key(b,cidx));
+    return (res<0)||( (res==0)&&(a<b) );
+  }
+  bool operator()(size_t a,const Key &b) const {
+    return compare(type,tbl.cell_key(a,cidx),b)<0;
+  }
+  bool operator()(const Key &a,size_t b) const {
+    return compare(type,a,tbl.cell_key(b,cidx))<0;
+  }
+
+  const Table &tbl;
+  int cidx;
+  Type type;
+};
+// }}}
+
+void Table::build_hash(int cidx,Index &idx) const // {{{
+{
+  const size_t nslots=this->nslots();
+  size_t size=4;
+  while (size<2*nslots) {
+    size*=2;
+  }
+  idx.head.assign(size,0);
+  idx.next.assign(nslots,0);
+  for (size_t slot=nslots;slot>0;) { // (chains in slot order)
+    slot--;
+    const char *buf;
+    unsigned int len;
+    if (cell_text(slot,cidx,buf,len)) {
+      const size_t bucket=hash_bytes(buf,len)&(size-1);
+      idx.next[slot]=idx.head[bucket];
+      idx.head[bucket]=slot+1;
+    }
+  }
+}
+// }}}
+
+const Table::Index *Table::index(int cidx,int type) const // {{{
+{
+  if ( (cidx<0)||(cidx>=(int)indexes.size())||(!(indexes[cidx].types&type)) ) {
+    return NULL;
+  }
+  Index &idx=indexes[cidx];
+  if (idx.stale) {
+    if (idx.types&HashIndex) {
+      build_hash(cidx,idx);
+    }
+    if (idx.types&SortedIndex) {
+      idx.sorted.clear();
+      const char *buf;
+      unsigned int len;
+      for (size_t slot=0;slot<nslots();slot++) {
+        if (cell_text(slot,cidx,buf,len)) {
+          idx.sorted.push_back(slot);
+        }
+      }
+      std::sort(idx.sorted.begin(),idx.sorted.end(),slot_less(*this,cidx));
+    }
+    idx.stale=false;
+  }
+  return &idx;
+}
+// }}}
+
+const std::vector<int> &Table::slot_ridx() const // {{{
+{
+  compact();
+  if (slot2ridx_stale) {
+    slot2ridx.assign(nslots(),-1);
+    const int len=size();
+    for (int iA=0;iA<len;iA++) {
+      slot2ridx[slot_of(iA)]=iA;
+    }
+    slot2ridx_stale=false;
+  }
+  return slot2ridx;
+}
+// }}}
+
+void Table::IBuild::addIndex(Table &csv,int cidx,int types) // {{{
+{
+  if (cidx<0) {
+    throw std::invalid_argument("bad cidx");
+  } else if (cidx>=(int)csv.indexes.size()) {
+    csv.indexes.resize(cidx+1);
+  }
+  Index &idx=csv.indexes[cidx];
+  idx.types|=types;
+  idx.stale=true;
+}
+// }}}
+
+void Table::IBuild::dropIndex(Table &csv,int cidx) // {{{
+{
+  if ( (cidx>=0)&&(cidx<(int)csv.indexes.size()) ) {
+    csv.indexes[cidx]=Index();
+  }
+}
+// }}}
+
+void Table::lookup(int cidx,const char *buf,int len,std::vector<int> &ret) const // {{{
+{
+  ret.clear();
+  const char *cbuf;
+  unsigned int clen;
+  const std::vector<int> &ridxs=slot_ridx();
+  if (const Index *idx=index(cidx,HashIndex)) {
+    const size_t bucket=hash_bytes(buf,len)&(idx->head.size()-1);
+    for (int pos=idx->head[bucket];pos;pos=idx->next[pos-1]) {
+      const size_t slot=pos-1;
+      if ( (ridxs[slot]>=0)&&(cell_text(slot,cidx,cbuf,clen))&&
+           (clen==(unsigned int)len)&&(memcmp(cbuf,buf,len)==0) ) {
+        ret.push_back(ridxs[slot]);
+      }
+    }
+  } else if ( (type(cidx)==String)&&((idx=index(cidx,SortedIndex))!=NULL) ) {
+    Key key;
+    key.buf=buf;
+    key.len=len;
+    std::vector<size_t>::const_iterator it=std::lower_bound(idx->sorted.begin(),idx->sorted.end(),key,slot_less(*this,cidx)),
+                                        end=std::upper_bound(it,idx->sorted.end(),key,slot_less(*this,cidx));
+    for (;it!=end;++it) {
+      if (ridxs[*it]>=0) {
+        ret.push_back(ridxs[*it]);
+      }
+    }
+  } else {
+    for (int iA=0;iA<size();iA++) {
+      if ( (cell_text(slot_of(iA),cidx,cbuf,clen))&&
+           (clen==(unsigned int)len)&&(memcmp(cbuf,buf,len)==0) ) {
+        ret.push_back(iA);
+      }
+    }
+  }
+  std::sort(ret.begin(),ret.end());
+}
+// }}}
+
+void Table::range(int cidx,const std::string &lo,const std::string &hi,std::vector<int> &ret) const // {{{
+{
+  ret.clear();
+  const Type ctype=type(cidx);
+  Key klo,khi;
+  klo.buf=lo.data();
+  klo.len=lo.size();
+  khi.buf=hi.data();
+  khi.len=hi.size();
+  bool ok=true, bval=false;
+  switch (ctype) {
+  case String: break;
+  case Int64:  ok=(parse_int64(lo.data(),lo.size(),klo.i))&&(parse_int64(hi.data(),hi.size(),khi.i)); break;
+  case Double: ok=(parse_double(lo.data(),lo.size(),klo.d))&&(parse_double(hi.data(),hi.size(),khi.d)); break;
+  case Bool:
+    ok=parse_bool(lo.data(),lo.size(),bval);
+    klo.i=bval;
+    ok=(ok)&&(parse_bool(hi.data(),hi.size(),bval));
+    khi.i=bval;
+    break;
+  }
+  if (!ok) {
+    throw std::invalid_argument("bad range for column type");
+  }
+
+  const std::vector<int> &ridxs=slot_ridx();
+  if (const Index *idx=index(cidx,SortedIndex)) {
+    std::vector<size_t>::const_iterator it=std::lower_bound(idx->sorted.begin(),idx->sorted.end(),klo,slot_less(*this,cidx)),
+                                        end=std::upper_bound(it,idx->sorted.end(),khi,slot_less(*this,cidx));
+    for (;it!=end;++it) {
+      if (ridxs[*it]>=0) {
+        ret.push_back(ridxs[*it]);
+      }
+    }
+  } else {
+    const char *cbuf;
+    unsigned int clen;
+    for (int iA=0;iA<size();iA++) {
+      if (cell_text(slot_of(iA),cidx,cbuf,clen)) {
+        const Key key=cell_key(slot_of(iA),cidx);
+        if ( (compare(ctype,klo,key)<=0)&&(compare(ctype,key,khi)<=0) ) {
+          ret.push_back(iA);
+        }
+      }
+    }
+  }
+  std::sort(ret.begin(),ret.end());
+}
+// }}}
+
+void Table::prefix(int cidx,const std::string &prefix,std::vector<int> &ret) const // {{{
+{
+  ret.clear();
+  const char *cbuf;
+  unsigned int clen;
+  const std::vector<int> &ridxs=slot_ridx();
+  const Index *idx;
+  if ( (type(cidx)==String)&&((idx=index(cidx,SortedIndex))!=NULL) ) {
+    Key key;
+    key.buf=prefix.data();
+    key.len=prefix.size();
+    std::vector<size_t>::const_iterator it=std::lower_bound(idx->sorted.begin(),idx->sorted.end(),key,slot_less(*this,cidx));
+    for (;it!=idx->sorted.end();++it) {
+      if ( (!cell_text(*it,cidx,cbuf,clen))||(clen<prefix.size())||
+           (memcmp(cbuf,prefix.data(),prefix.size())!=0) ) {
+        break;
+      }
+      if (ridxs[*it]>=0) {
+        ret.push_back(ridxs[*it]);
+      }
+    }
+  } else {
+    for (int iA=0;iA<size();iA++) {
+      if ( (cell_text(slot_of(iA),cidx,cbuf,clen))&&(clen>=prefix.size())&&
+           (memcmp(cbuf,prefix.data(),prefix.size())==0) ) {
+        ret.push_back(iA);
+      }
+    }
+  }
+  std::sort(ret.begin(),ret.end());
+}
+// }}}
+
+void hash_join(const Table &left,int lcidx,const Table &right,int rcidx, // {{{
+               std::vector<std::pair<int,int> > &ret)
+{
+  ret.clear();
+  left.compact();
+  Table::Index tmp;
+  const Table::Index *idx=right.index(rcidx,HashIndex);
+  if (!idx) {
+    right.build_hash(rcidx,tmp);
+    idx=&tmp;
+  }
+  const std::vector<int> &ridxs=right.slot_ridx();
+  const size_t mask=idx->head.size()-1;
+
+  const char *lbuf,*rbuf;
+  unsigned int llen,rlen;
+  for (int iA=0;iA<left.size();iA++) {
+    if (!left.cell_text(left.slot_of(iA),lcidx,lbuf,llen)) {
+      continue;
+    }
+    for (int pos=idx->head[hash_bytes(lbuf,llen)&mask];pos;pos=idx->next[pos-1]) {
+      const size_t slot=pos-1;
+      if ( (ridxs[slot]>=0)&&(right.cell_text(slot,rcidx,rbuf,rlen))&&
+           (rlen==llen)&&(memcmp(rbuf,lbuf,llen)==0) ) {
+        ret.push_back(std::make_pair(iA,ridxs[slot]));
+      }
+    }
+  }
+}
+// }}}
+
+// }}}
+
+
+Predicate::Predicate(func fn,void *user) // {{{
+  : kind(Func),
+    fn(fn),user(user),
+    lo(0),hi(0)
+{
+}
+// }}}
+
+Predicate Predicate::equal(const std::string &value) // {{{
+{
+  Predicate ret;
+  ret.kind=Equal;
+  ret.fn=NULL;
+  ret.user=NULL;
+  ret.value=value;
+  ret.lo=ret.hi=0;
+  return ret;
+}
+// }}}
+
+Predicate Predicate::range(int64_t lo,int64_t hi) // {{{
+{
+  Predicate ret;
+  ret.kind=Range;
+  ret.fn=NULL;
+  ret.user=NULL;
+  ret.lo=lo;
+  ret.hi=hi;
+  return ret;
+}
+// }}}
+
+bool Predicate::operator()(const char *buf,int len) const // {{{
+{
+  switch (kind) {
+  case Func:
+    return fn(buf,len,user);
+  case Equal:
+    return (buf)&&((size_t)len==value.size())&&(memcmp(buf,value.data(),len)==0);
+  case Range: {
+    int64_t val;
+    return (buf)&&(parse_int64(buf,len,val))&&(val>=lo)&&(val<=hi);
+  }
+  }
+  return false;
+}
+// }}}
+
+builder::builder(Table &result,bool first_is_header,int infer_rows) // {{{
+  : result(result),
     cidx(-1),
-    as_header(first_is_header)
+    as_header(first_is_header),
+    infer_rows(infer_rows),
+    stored_all(true),
+    decide_col(-1),
+    pos(0),last_col(-1),
+    pending(false),dropped(false)
 {
 }
 // }}}
 
 void builder::begin_row() // {{{
 {
+  pos=0;
+  last_col=-1;
+  proj.skip_row(false);
+  proj.clear_consulted(); // (the parser calls keep(0) next)
   if (as_header) {
-    row=NULL;
     return;
   }
-  row=&Table::IBuild::newRow(result);
   cidx=0;
+  dropped=false;
+  for (size_t iA=0;iA<wheres.size();iA++) {
+    if ( (wheres[iA].col<0)&&(!wheres[iA].pred(NULL,0)) ) {
+      dropped=true;
+      proj.skip_row(true);
+      return;
+    }
+  }
+  if (decide_col<0) {
+    row=Table::IBuild::newRow(result);
+    pending=false;
+  } else {
+    pending=true;
+    pend_data.clear();
+    pend_len.clear();
+  }
 }
 // }}}
 
 void builder::cell(const char *buf,int len) // {{{
 {
+  if (dropped) { // (parser did not use projection())
+    return;
+  }
+  int col=pos++;
+  if ( (!proj.keeps_all())&&(proj.was_consulted()) ) { // k-th delivered cell is columns()[k]
+    if (col>=(int)proj.columns().size()) {
+      return;
+    }
+    col=proj.columns()[col];
+  } else if (!proj.contains(col)) { // (parser delivers all cells)
+    return;
+  }
+  last_col=col;
   if (as_header) {
-//    header.emplace_back(buf,len);
-    header.push_back(std::string(buf,len));
+    if (col>=(int)header.size()) {
+      header.resize(col+1);
+    }
+//    header[col].assign(buf,len);
+    header[col]=(buf) ? std::string(buf,len) : std::string();
     return;
   }
-  assert(row);
-  row->set(cidx++,std::string(buf,len));
+
+  if (col<=decide_col) {
+    for (size_t iA=0;iA<wheres.size();iA++) {
+      if ( (wheres[iA].col==col)&&(!wheres[iA].pred(buf,len)) ) {
+        dropped=true;
+        proj.skip_row(true);
+        return;
+      }
+    }
+  }
+  if ( (stored_all)||( (col<(int)store_idx.size())&&(store_idx[col]>=0) ) ) {
+    if (!pending) {
+      row.set(cidx++,buf,len);
+    } else if (buf) {
+      pend_data.append(buf,len);
+      pend_len.push_back(len);
+    } else {
+      pend_len.push_back(-1);
+    }
+  }
+  if ( (pending)&&(col>=decide_col) ) {
+    commit_row();
+  }
+}
+// }}}
+
+void builder::commit_row() // {{{
+{
+  row=Table::IBuild::newRow(result);
+  const char *buf=pend_data.data();
+  for (size_t iA=0;iA<pend_len.size();iA++) {
+    if (pend_len[iA]<0) {
+      row.set(cidx++,NULL,0);
+    } else {
+      row.set(cidx++,buf,pend_len[iA]);
+      buf+=pend_len[iA];
+    }
+  }
+  pending=false;
 }
 // }}}
 
@@ -308,8 +1746,139 @@ void builder::end_row() // {{{
 {
   if (as_header) {
     Table::IBuild::setHeader(result,header);
+    if (!proj_names.empty()) { // (the parser delivered all cells)
+      std::vector<int> cidxs;
+      for (size_t iA=0;iA<proj_names.size();iA++) {
+        cidxs.push_back(result.find_column(proj_names[iA]));
+      }
+      csv_projection tmp(cidxs); // (sorted, unique)
+      stored=tmp.columns();
+      stored_all=false;
+      proj_names.clear();
+    }
+    for (size_t iA=0;iA<wheres.size();iA++) {
+      if (!wheres[iA].name.empty()) {
+        wheres[iA].col=result.find_column(wheres[iA].name);
+        wheres[iA].name.clear();
+      }
+    }
+    update_projection();
+
+    if (!stored_all) {
+      std::vector<std::string> names;
+      for (size_t iA=0;iA<stored.size();iA++) {
+        names.push_back( (stored[iA]<(int)header.size()) ? header[stored[iA]] : std::string() );
+      }
+      Table::IBuild::setHeader(result,names);
+    }
     header.clear();
     as_header=false;
+    return;
+  } else if (dropped) {
+    return;
+  } else if (pending) { // remaining predicates: missing cells
+    for (size_t iA=0;iA<wheres.size();iA++) {
+      if ( (wheres[iA].col>last_col)&&(!wheres[iA].pred(NULL,0)) ) {
+        return;
+      }
+    }
+    commit_row();
+  }
+  if ( (infer_rows>0)&&(result.size()>=infer_rows) ) {
+    Table::IBuild::inferTypes(result,infer_rows);
+    infer_rows=0;
+  }
+}
+// }}}
+
+void builder::abort_row() // {{{
+{
+  if (as_header) { // (next row is the header)
+    header.clear();
+    return;
+  } else if ( (!dropped)&&(!pending) ) {
+    result.pop_row();
+  }
+  dropped=true;
+  pending=false;
+}
+// }}}
+
+void builder::update_projection() // {{{
+{
+  decide_col=-1;
+  bool names=!proj_names.empty();
+  std::vector<int> cols(stored);
+  for (size_t iA=0;iA<wheres.size();iA++) {
+    if (wheres[iA].col>decide_col) {
+      decide_col=wheres[iA].col;
+    }
+    cols.push_back(wheres[iA].col);
+    names|=!wheres[iA].name.empty();
+  }
+
+  if ( (stored_all)||(names) ) { // (names: header row gets all cells)
+    proj.clear();
+    store_idx.clear();
+    return;
+  }
+  proj.set(cols);
+
+  store_idx.assign( (stored.empty()) ? 0 : stored.back()+1,-1);
+  for (size_t iA=0;iA<stored.size();iA++) {
+    store_idx[stored[iA]]=iA;
+  }
+}
+// }}}
+
+void builder::project(const std::vector<int> &cidxs) // {{{
+{
+  csv_projection tmp(cidxs); // (sorted, unique)
+  stored=tmp.columns();
+  stored_all=false;
+  proj_names.clear();
+  update_projection();
+}
+// }}}
+
+void builder::project(const std::vector<std::string> &names) // {{{
+{
+  if (!as_header) { // nothing to resolve against
+    throw std::invalid_argument("project by name requires first_is_header");
+  }
+  proj_names=names;
+  if (names.empty()) {
+    stored.clear();
+    stored_all=false;
+  }
+  update_projection();
+}
+// }}}
+
+void builder::where(int cidx,const Predicate &pred) // {{{
+{
+  Where w={cidx,std::string(),pred};
+  wheres.push_back(w);
+  update_projection();
+}
+// }}}
+
+void builder::where(const std::string &name,const Predicate &pred) // {{{
+{
+  if (!as_header) {
+    throw std::invalid_argument("where by name requires first_is_header");
+  }
+  Where w={-1,name,pred};
+  wheres.push_back(w);
+  update_projection();
+}
+// }}}
+
+void builder::finish() // {{{
+{
+  if (infer_rows>0) {
+    Table::IBuild::inferTypes(result,infer_rows);
+    infer_rows=0;
   }
 }
 // }}}
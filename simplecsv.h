@@ -1,44 +1,109 @@
 #ifndef _SIMPLECSV_H
 #define _SIMPLECSV_H
 
-#include <map>
+#include <stdint.h>
+#include <string>
 #include <vector>
-#include "nocase.h"
+#include <utility>
 #include "csvbase.h"
+#include "csvprojection.h"
+
+class csv_outbuf; // csvoutbuf.h
 
 namespace SimpleCSV {
 
+// monotonic chunked (bump) allocator, frees everything at once
+class Arena {
+  Arena(const Arena&); // = delete
+  Arena &operator=(const Arena &);
+public:
+  explicit Arena(size_t chunksize=256*1024);
+  ~Arena();
+
+  char *alloc(size_t size); // (unaligned)
+  const char *strdup(const char *buf,size_t len); // NUL-terminated copy
+
+  size_t chunks() const { return blocks.size(); }
+private:
+  char *alloc_chunk(size_t size);
+private:
+  size_t chunksize;
+  char *pos,*end;
+  std::vector<char *> blocks;
+};
+
+// column types (cf. Table::IBuild::inferTypes)
+enum Type {
+  String=0,
+  Int64,
+  Double,
+  Bool    // true/false (case insensitive)
+};
+
+// secondary indexes (Table::IBuild::addIndex)
+enum IndexType {
+  HashIndex=1,    // equality (cell text)
+  SortedIndex=2   // ranges (by column type), prefixes
+};
+
 class Table;
 class Row;
+
+// resolved column (Table::column()): Row access without name lookup
+class Column {
+public:
+  Column() : cidx(-1) {} // invalid
+  bool valid() const { return cidx>=0; }
+  int index() const { return cidx; }
+private:
+  friend class Table;
+  explicit Column(int cidx) : cidx(cidx) {}
+private:
+  int cidx;
+};
+
+// NOTE: Value and Row are handles into Table's (columnar) storage;
+// a Value (and asCString()) stays valid until its cell is set again (or Table is destroyed)
 class Value {
 public:
+  // typed columns: native value (asInt(): clamped to int); otherwise lenient, like atoi / atof:
+  // leading whitespace, prefix ("5 ", "12abc"), 0 without digits (asBool(): false)
   int asInt() const;
+  int64_t asInt64() const;
+  double asDouble() const;
+  bool asBool() const;
   const char *asCString() const;
-  const std::string &asString() const;
+  std::string asString() const; // (by value: Values are temporary handles)
+
+  // explicit error status: false for NULL, invalid or out of range (whole string,
+  // locale-independent; no nan / inf)
+  bool toInt64(int64_t &ret) const;
+  bool toDouble(double &ret) const;
+  bool toBool(bool &ret) const;
+
+  bool isNull() const { return !buf; } // NULL cell (or none at all)
 
 private:
-  friend class Table;
   friend class Row;
-  Value(const Row &parent,int cidx,const std::string &value);
-
-  Value(const Value&); // = delete
-  Value &operator=(const Value &);
+  friend class Table;
+  Value(const char *buf,unsigned int len) : buf(buf),len(len),type(String) {}
 private:
-  // parent, cidx  are currently unused
-  const Row &parent;
-  int cidx;
-
-  std::string value;
+  const char *buf;  // NUL-terminated
+  unsigned int len;
+  Type type;
+  union {
+    int64_t i;  // Int64, Bool
+    double d;   // Double
+  } num;
 };
 
 class Row {
-  Row(const Row&); // = delete
-  Row &operator=(const Row &);
 public:
-  ~Row();
+  Row() : parent(NULL),ridx(-1),slot(0) {} // empty row
 
-  const Value &operator[](const char *key) const;
-  const Value &operator[](int cidx) const;
+  Value operator[](const char *key) const;
+  Value operator[](int cidx) const;
+  Value operator[](Column col) const { return operator[](col.index()); }
 
   int size() const;
 
@@ -46,66 +111,262 @@ public:
 public:
   // special case: &value==&del
   void set(int cidx,const std::string &value);  // non-const !
+  void set(int cidx,const char *buf,int len);   // buf==NULL: NULL cell
 
   static const std::string del; // sentinel
 private:
   friend class Table;
-  Row(Table &parent,int ridx);
+  Row(Table *parent,int ridx,size_t slot)
+    : parent(parent),ridx(ridx),slot(slot)
+  {}
   void write(csv_builder &out) const;
 private:
-  Table &parent;
+  Table *parent;
   int ridx;
-
-  std::map<unsigned int,Value *> columns;  // TODO: not by *? (need move?)
+  size_t slot; // storage index, independent of ridx
 };
 
 class Table {
   Table(const Table&); // = delete
   Table &operator=(const Table &);
 public:
-  Table() {} // = default
+  Table() : snap(NULL),ndead(0),slot2ridx_stale(true) {}
   ~Table();
 
-  const Row &operator[](int ridx) const;
+  const Row operator[](int ridx) const;
   int size() const;
 
   void dump() const;
 public:
   class IBuild {
   public:
+    // the returned Row stays valid until the next newRow() / insertRow() on csv (copy it to keep it)
     static Row &newRow(Table &csv);
-    static Row &insertRow(Table &csv,int at_ridx); // 0<at_ridx<=size();   // replaces! (TODO? real insert?)
-    static void deleteRow(Table &csv,int ridx);  // (moves elements!)
+    static Row &insertRow(Table &csv,int at_ridx); // 0<at_ridx<=size(); (O(n), but O(log n) after deleteRow(at_ridx))
+    static void deleteRow(Table &csv,int ridx);  // (tombstone, O(log n); later rows move down)
+
+    // batch edits in one pass; ridxs refer to the numbering before the call.
+    // insertRows: a new row before each at_ridxs[i] (ascending, <=size()) -> ret[i]
+    static void insertRows(Table &csv,const std::vector<int> &at_ridxs,std::vector<Row> &ret);
+    static void deleteRows(Table &csv,const std::vector<int> &ridxs); // (any order, duplicates ok)
 
     static void setHeader(Table &csv,const std::vector<std::string>& names);
+
+    // samples the first sample_rows rows; all-NULL columns stay String.
+    // Later cells not matching a column's type relax it (Int64 -> Double -> String)
+    static void inferTypes(Table &csv,int sample_rows=1000);
+    static void setType(Table &csv,int cidx,Type type); // (relaxed, if needed)
+
+    // indexes are marked stale by changes and rebuilt at the next lookup
+    static void addIndex(Table &csv,int cidx,int types=HashIndex|SortedIndex);
+    static void dropIndex(Table &csv,int cidx);
+
+    // maps a snapshot (Table::saveSnapshot) into an empty csv: Rows / Values are served
+    // directly from the mapping; csv is read-only then (edits throw std::logic_error)
+    // NOTE: returns true on error (errno; EINVAL: bad snapshot)
+    static bool loadSnapshot(Table &csv,const char *filename);
   };
   friend class IBuild;
 
   void write(csv_builder &out,bool with_header=false) const; // TODO header_if_not_empty?
+
+  // same output as write(csv_writer<>(qchar,sep,smart_quote),with_header): row ranges are
+  // formatted on threads (0: online cpus) into memory buffers, appended to out in order
+  // NOTE: returns true on write error (also see out.flush())
+  bool write_parallel(csv_outbuf &out,bool with_header=false,int threads=0,
+                      char qchar='"',char sep=',',bool smart_quote=false) const;
+
+  Type type(int cidx) const;
+
+  // binary snapshot: header, cells (incl. NULL vs. empty), column types and native values
+  // NOTE: returns true on error (errno)
+  bool saveSnapshot(const char *filename) const;
+
+  // case insensitive (ASCII); first matching column
+  Column column(const char *name) const;
+  Column column(const std::string &name) const;
+
+  // results are ridx (ascending); uses an index of cidx, if any, otherwise scans.
+  // NOTE: (re)builds stale indexes, i.e. concurrent lookups are only safe after a first one
+  void lookup(int cidx,const char *buf,int len,std::vector<int> &ret) const; // equal cell text
+  void lookup(int cidx,const std::string &key,std::vector<int> &ret) const {
+    lookup(cidx,key.data(),key.size(),ret);
+  }
+  void range(int cidx,const std::string &lo,const std::string &hi,std::vector<int> &ret) const; // [lo,hi]
+  void prefix(int cidx,const std::string &prefix,std::vector<int> &ret) const; // cell text
+
+  friend void hash_join(const Table &left,int lcidx,const Table &right,int rcidx,
+                        std::vector<std::pair<int,int> > &ret);
 private:
   friend class Row;
-  int find_column(const std::string &name) const;
+  friend class builder;
+  int find_column(const char *name,size_t len) const;
+  int find_column(const std::string &name) const { return find_column(name.data(),name.size()); }
 
-  static const Row empty_row;      // sentinel
-  static const Value empty_value;  // sentinel
+  size_t newSlot();
+  size_t nslots() const;
+  int rowsize(size_t slot) const;
+  Value get(size_t slot,int cidx) const;
+  void set(size_t slot,int cidx,const char *buf,int len);
+  void del(size_t slot,int cidx);
+
+  struct Key {
+    const char *buf;
+    unsigned int len;
+    int64_t i;
+    double d;
+  };
+  struct Index;
+  struct slot_less;
+  struct WriteJob;
+  bool cell_text(size_t slot,int cidx,const char *&buf,unsigned int &len) const;
+  Key cell_key(size_t slot,int cidx) const;
+  static int compare(Type type,const Key &a,const Key &b);
+  void build_hash(int cidx,Index &idx) const;
+  const Index *index(int cidx,int type) const; // up to date, or NULL
+  void stale_index(int cidx) {
+    if ( (cidx<(int)indexes.size())&&(indexes[cidx].types) ) {
+      indexes[cidx].stale=true;
+    }
+  }
+  const std::vector<int> &slot_ridx() const;
+
+  size_t slot_of(int ridx) const {
+    return (snap) ? ridx : (ndead) ? rows[select(ridx)] : rows[ridx];
+  }
+  size_t select(int ridx) const;
+  void kill(size_t pos);
+  void build_tree() const;
+  void append_row(size_t slot);
+  void compact() const;
+  void pop_row(); // (last, e.g. of an aborted parse; its slot is reclaimed, if last)
 private:
-  std::multimap<std::string,int,lt_nocase_str> rev_column;
-  std::vector<const std::string *> columnnames;
-  std::vector<Row *> rows;  // CPP11:  std::unique_ptr!   OR  by-value(Row moveable)?
+  std::vector<std::string> columnnames;
+  std::vector<int> name_index; // open addressing by case-folded hash: cidx+1 (0: empty)
+
+  struct ColumnData {
+    ColumnData() : type(String) {}
+
+    std::vector<const char *> str; // [slot] -> arena, NUL-terminated
+    std::vector<unsigned int> len; // [slot]
+    std::vector<bool> null;        // [slot]; also for missing cells
+
+    Type type;
+    std::vector<int64_t> i64;      // [slot], for Int64, Bool
+    std::vector<double> dbl;       // [slot], for Double
+  };
+  bool convert(ColumnData &col,Type type);
+
+  struct Snapshot;   // mapped, read-only storage (slot==ridx); columns[].type still used
+  Snapshot *snap;
+  void writable() const; // throws for snap
+  Arena arena;  // string bytes of all cells
+  std::vector<ColumnData> columns;
+  std::vector<int> rowsizes;  // [slot] -> number of cells
+  // [ridx] -> slot; deleteRow() only marks a tombstone, compacted lazily (>half dead, or before
+  // batch edits and scans; newRow() / insertRow() keep them); ridx -> pos then by a Fenwick
+  // tree over the live rows
+  mutable std::vector<size_t> rows;   // [pos] -> slot
+  mutable std::vector<char> dead;     // [pos] (ndead>0)
+  mutable std::vector<int> live_tree; // [pos+1] (ndead>0)
+  mutable size_t ndead;
+
+  struct Index {
+    Index() : types(0),stale(true) {}
+
+    int types;   // IndexType bits
+    bool stale;
+    std::vector<int> head;      // HashIndex: hash bucket -> slot+1 (0: none)
+    std::vector<int> next;      // HashIndex: [slot] -> slot+1, same bucket
+    std::vector<size_t> sorted; // SortedIndex: slots (without NULL cells)
+  };
+  mutable std::vector<Index> indexes;  // [cidx]; by slot, i.e. independent of ridx
+  mutable std::vector<int> slot2ridx;  // [slot] -> ridx or -1 (deleted)
+  mutable bool slot2ridx_stale;
+
+  Row built; // last IBuild::newRow() / insertRow()
+};
+
+// pairs (left ridx,right ridx) of rows with equal cell text; uses right's HashIndex, if any
+void hash_join(const Table &left,int lcidx,const Table &right,int rcidx,
+               std::vector<std::pair<int,int> > &ret);
+
+// row filter for builder::where()
+class Predicate {
+public:
+  typedef bool (*func)(const char *buf,int len,void *user); // buf==NULL: NULL cell
+  explicit Predicate(func fn,void *user=NULL);
+
+  static Predicate equal(const std::string &value); // (NULL does not match)
+  static Predicate range(int64_t lo,int64_t hi);    // integer in [lo,hi]
+
+  bool operator()(const char *buf,int len) const;
+private:
+  Predicate() {}
+  enum Kind { Func, Equal, Range };
+  Kind kind;
+  func fn;
+  void *user;
+  std::string value;
+  int64_t lo,hi;
 };
 
 class builder : public csv_builder {
 public:
-  builder(Table &result,bool first_is_header=false);
+  // infer_rows>0: Table::IBuild::inferTypes() after that many rows (or at finish())
+  builder(Table &result,bool first_is_header=false,int infer_rows=0);
   void begin_row();// override;
   void cell(const char *buf,int len);// override;
   void end_row();// override;
+  void abort_row();// override;  (lenient parsing: drops the row)
+
+  void finish(); // end of input
+
+  // Only the projected columns are stored, as columns 0..n-1 (in original order);
+  // names are resolved at the header row (requires first_is_header), unknown names are ignored.
+  // The parser should skip the other cells: cp.set_projection(bld.projection());
+  // otherwise (all cells delivered) the builder filters them itself
+  void project(const std::vector<int> &cidxs);
+  void project(const std::vector<std::string> &names);
+  const csv_projection *projection() const { return &proj; }
+
+  // Rows failing a predicate are dropped as soon as its cell is parsed: the cells before are
+  // only buffered (no Row is created), the rest of the row is skipped via projection().
+  // cidx / name refer to the input columns; a missing cell (or unknown name) is NULL
+  void where(int cidx,const Predicate &pred);
+  void where(const std::string &name,const Predicate &pred); // (requires first_is_header)
+private:
+  void update_projection();
+  void commit_row();
 private:
   Table &result;
-  Row *row;
+  Row row;
   int cidx;
   bool as_header;
-  std::vector<std::string> header;
+  int infer_rows;
+  std::vector<std::string> header;  // [input column]
+
+  csv_projection proj;   // for the parser: stored and predicate columns
+  bool stored_all;
+  std::vector<int> stored;             // input columns, sorted (!stored_all)
+  std::vector<int> store_idx;          // input column -> cidx or -1 (!stored_all)
+  std::vector<std::string> proj_names; // (until the header row)
+
+  struct Where {
+    int col;           // input column, -1: unknown
+    std::string name;  // (until the header row)
+    Predicate pred;
+  };
+  std::vector<Where> wheres;
+  int decide_col;      // largest predicate column, or -1
+
+  // current row
+  int pos;             // delivered cells
+  int last_col;        // input column of the last delivered cell
+  bool pending;        // no Row yet: cells are buffered
+  bool dropped;
+  std::string pend_data;
+  std::vector<int> pend_len;  // -1: NULL
 };
 
 } // namespace SimpleCSV
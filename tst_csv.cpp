@@ -1,7 +1,22 @@
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <zlib.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
 #include "csvparser.h"
+#include "csvparallel.h"
+#include "csvfile.h"
+#include "csvreader.h"
+#include "csvzinput.h"
 #include "csvwriter.h"
+#include "csvoutbuf.h"
 #include "simplecsv.h"
 
 #if !defined(__GXX_EXPERIMENTAL_CXX0X__)&&(__cplusplus<201103L)
@@ -30,6 +45,770 @@ public:
   void cell(const char *buf,int len) override {}
 };
 
+class record_builder : public csv_builder {
+public:
+  void begin_row() override {
+    result.append("[");
+  }
+  void cell(const char *buf,int len) override {
+    if (!buf) {
+      result.append("(null)|");
+    } else {
+      result.append(buf,len);
+      result.append("|");
+    }
+  }
+  void end_row() override {
+    result.append("]\n");
+  }
+
+  std::string result;
+};
+
+// csvparser vs. csvparser_fsm
+static void diff_fsm(const char *input) // {{{
+{
+  record_builder r1,r2,r3;
+  csvparser cp1(r1,'\'');
+  csvparser_fsm cp2(r2,'\'');
+  basic_csvparser<record_builder> cp3(r3,'\''); // static dispatch
+  cp1.set_zero_copy(true);
+
+  const char *buf1=input,*buf2=input,*buf3=input;
+  const bool err1=cp1(buf1,strlen(input)),
+             err2=cp2(buf2,strlen(input)),
+             err3=cp3(buf3,strlen(input));
+  if ( (r1.result!=r2.result)||(err1!=err2)||(buf1!=buf2)||
+       ( (err1)&&(strcmp(cp1.error(),cp2.error())!=0) ) ||
+       (r3.result!=r1.result)||(err3!=err1)||(buf3!=buf1) ) {
+    fprintf(stderr,"parser mismatch for: %s\n%s---\n%s",input,r1.result.c_str(),r2.result.c_str());
+    assert(0);
+  }
+}
+// }}}
+
+// whole input vs. input split in two chunks, at every position
+static void split_chunks(const char *input) // {{{
+{
+  const int len=strlen(input);
+  record_builder r0;
+  csvparser cp0(r0,'\'');
+  const char *buf=input;
+  const bool err0=cp0(buf,len)||cp0.finish();
+
+  for (int iA=0;iA<=len;iA++) {
+    record_builder r1;
+    csvparser cp1(r1,'\'');
+    cp1.set_zero_copy(true);
+    const char *buf1=input,*buf2=input+iA;
+    const bool err1=cp1(buf1,iA)||cp1(buf2,len-iA)||cp1.finish();
+    if ( (r0.result!=r1.result)||(err0!=err1) ) {
+      fprintf(stderr,"chunked mismatch at %d for: %s\n%s---\n%s",iA,input,r0.result.c_str(),r1.result.c_str());
+      assert(0);
+    }
+  }
+}
+// }}}
+
+// drops the cells of columns not in proj
+class project_builder : public record_builder {
+public:
+  project_builder(const csv_projection &proj) : proj(proj),col(0) {}
+
+  void begin_row() override {
+    record_builder::begin_row();
+    col=0;
+  }
+  void cell(const char *buf,int len) override {
+    if (proj.keep(col++)) {
+      record_builder::cell(buf,len);
+    }
+  }
+private:
+  const csv_projection &proj;
+  int col;
+};
+
+// csvparser with projection (input split in two chunks, at every position) vs. filtered output
+static void projection_chunks(const char *input) // {{{
+{
+  std::vector<int> cidxs;
+  cidxs.push_back(3);
+  cidxs.push_back(1);
+  const csv_projection proj(cidxs);
+
+  const int len=strlen(input);
+  project_builder r0(proj);
+  csvparser cp0(r0,'\'');
+  const char *buf=input;
+  const bool err0=cp0(buf,len)||cp0.finish();
+
+  for (int iA=0;iA<=len;iA++) {
+    record_builder r1;
+    csvparser cp1(r1,'\'');
+    cp1.set_zero_copy(true);
+    cp1.set_projection(&proj);
+    const char *buf1=input,*buf2=input+iA;
+    const bool err1=cp1(buf1,iA)||cp1(buf2,len-iA)||cp1.finish();
+    if ( (r0.result!=r1.result)||(err0!=err1) ) {
+      fprintf(stderr,"projection mismatch at %d for: %s\n%s---\n%s",iA,input,r0.result.c_str(),r1.result.c_str());
+      assert(0);
+    }
+  }
+}
+// }}}
+
+// lookup, range and prefix results of a few keys, as string
+static std::string index_queries(const SimpleCSV::Table &tbl) // {{{
+{
+  static const char *const keys[]={"a","ab","b","abc",""};
+  std::string ret;
+  std::vector<int> res;
+  char buf[16];
+  for (unsigned int iA=0;iA<sizeof(keys)/sizeof(*keys);iA++) {
+    tbl.lookup(0,keys[iA],res);
+    res.push_back(-1);
+    tbl.prefix(0,keys[iA],res);
+    res.push_back(-2);
+    for (size_t iB=0;iB<res.size();iB++) {
+      snprintf(buf,sizeof(buf),"%d,",res[iB]);
+      ret.append(buf);
+    }
+  }
+  tbl.range(1,"-2","10",res);
+  for (size_t iB=0;iB<res.size();iB++) {
+    snprintf(buf,sizeof(buf),"%d;",res[iB]);
+    ret.append(buf);
+  }
+  return ret;
+}
+// }}}
+
+static void check_indexes() // {{{
+{
+  SimpleCSV::Table tbl;
+  SimpleCSV::builder bld(tbl,false,10);
+  csvparser cp(bld);
+  cp("ab,5\nb,-3\na,10\nabc,11\nab,-2\n,0\na\nb,1\n");
+  cp.finish();
+  bld.finish();
+  assert(tbl.type(1)==SimpleCSV::Int64);
+
+  const std::string scan=index_queries(tbl);
+  SimpleCSV::Table::IBuild::addIndex(tbl,0);
+  SimpleCSV::Table::IBuild::addIndex(tbl,1,SimpleCSV::SortedIndex);
+  assert(index_queries(tbl)==scan);
+
+  SimpleCSV::Table::IBuild::deleteRow(tbl,2);
+  SimpleCSV::Row &ins=SimpleCSV::Table::IBuild::insertRow(tbl,0);
+  ins.set(0,"b");
+  SimpleCSV::Row row=tbl[4];
+  row.set(1,"7");
+  const std::string indexed=index_queries(tbl);
+  SimpleCSV::Table::IBuild::dropIndex(tbl,0);
+  SimpleCSV::Table::IBuild::dropIndex(tbl,1);
+  assert(index_queries(tbl)==indexed);
+
+  std::vector<int> res;
+  tbl.lookup(0,"b",res);
+  assert( (res.size()==3)&&(res[0]==0)&&(res[1]==2)&&(res[2]==7) );
+
+  SimpleCSV::Table tbl2;
+  SimpleCSV::builder bld2(tbl2);
+  csvparser cp2(bld2);
+  cp2("b,x\nab,y\nb,z\n");
+  cp2.finish();
+  std::vector<std::pair<int,int> > join;
+  SimpleCSV::hash_join(tbl,0,tbl2,0,join);
+  assert(join.size()==8); // b: 3*2, ab: 2*1
+  assert( (join[0]==std::make_pair(0,0))&&(join[1]==std::make_pair(0,2))&&(join[2]==std::make_pair(1,1)) );
+}
+// }}}
+
+// random single and batch row edits vs. a plain vector
+static void check_row_edits() // {{{
+{
+  SimpleCSV::Table tbl;
+  std::vector<int> ref;
+  char buf[16];
+  unsigned int seed=1;
+  for (int iA=0;iA<2000;iA++) {
+    seed=seed*1103515245+12345;
+    const int op=(seed>>16)%8,size=ref.size();
+    const int ridx=(size) ? (seed>>8)%(size+1) : 0;
+    if (op<2) {
+      snprintf(buf,sizeof(buf),"%d",iA);
+      SimpleCSV::Table::IBuild::insertRow(tbl,ridx).set(0,buf);
+      ref.insert(ref.begin()+ridx,iA);
+    } else if (op==2) { // (keeps tombstones)
+      snprintf(buf,sizeof(buf),"%d",iA);
+      SimpleCSV::Table::IBuild::newRow(tbl).set(0,buf);
+      ref.push_back(iA);
+    } else if (op<6) {
+      SimpleCSV::Table::IBuild::deleteRow(tbl,ridx);
+      if (ridx<size) {
+        ref.erase(ref.begin()+ridx);
+      }
+      if ( (op==5)&&(ridx<size) ) { // replace: reuses the tombstone
+        snprintf(buf,sizeof(buf),"%d",iA);
+        SimpleCSV::Table::IBuild::insertRow(tbl,ridx).set(0,buf);
+        ref.insert(ref.begin()+ridx,iA);
+      }
+    } else if (op==6) {
+      std::vector<int> at;
+      for (int iB=0;iB<5;iB++) {
+        at.push_back((ridx+iB*7)%(size+1));
+      }
+      std::sort(at.begin(),at.end());
+      std::vector<SimpleCSV::Row> rows;
+      SimpleCSV::Table::IBuild::insertRows(tbl,at,rows);
+      for (int iB=4;iB>=0;iB--) {
+        snprintf(buf,sizeof(buf),"%d",-iA*10-iB);
+        rows[iB].set(0,buf);
+        ref.insert(ref.begin()+at[iB],-iA*10-iB);
+      }
+    } else {
+      std::vector<int> del;
+      for (int iB=0;iB<5;iB++) {
+        del.push_back((ridx+iB*iB*3)%(size+1));
+      }
+      SimpleCSV::Table::IBuild::deleteRows(tbl,del);
+      std::sort(del.begin(),del.end());
+      del.erase(std::unique(del.begin(),del.end()),del.end());
+      for (int iB=del.size()-1;iB>=0;iB--) {
+        if (del[iB]<size) {
+          ref.erase(ref.begin()+del[iB]);
+        }
+      }
+    }
+    assert(tbl.size()==(int)ref.size());
+    if (iA%10==0) {
+      for (size_t iB=0;iB<ref.size();iB++) {
+        assert(tbl[iB][0].asInt()==ref[iB]);
+      }
+    }
+  }
+
+  // queue: delete the first row, append one (no compaction per append)
+  SimpleCSV::Table queue;
+  for (int iA=0;iA<5000;iA++) {
+    if (iA>=100) {
+      SimpleCSV::Table::IBuild::deleteRow(queue,0);
+    }
+    snprintf(buf,sizeof(buf),"%d",iA);
+    SimpleCSV::Table::IBuild::newRow(queue).set(0,buf);
+    assert( (queue.size()==std::min(iA+1,100))&&(queue[queue.size()-1][0].asInt()==iA) );
+  }
+  for (int iA=0;iA<100;iA++) {
+    assert(queue[iA][0].asInt()==4900+iA);
+  }
+}
+// }}}
+
+// Table::write_parallel vs. Table::write
+static void check_write_parallel() // {{{
+{
+  csv_outbuf empty; // (empty cell before the first allocation)
+  empty("",0);
+  assert( (empty.size()==0)&&(*empty.data()==0) );
+
+  SimpleCSV::Table tbl;
+  SimpleCSV::builder bld(tbl,true);
+  csvparser cp(bld);
+  cp("id,\"te,xt\",n\n");
+  char buf[64];
+  for (int iA=0;iA<30000;iA++) {
+    snprintf(buf,sizeof(buf),"%d,\"a\"\"%d\",%s\n",iA,iA*7,(iA%3) ? "x y" : "");
+    cp(buf);
+  }
+  cp.finish();
+  SimpleCSV::Table::IBuild::deleteRow(tbl,5);
+
+  for (int smart=0;smart<2;smart++) {
+    csv_writer<csv_outbuf> wr('"',';',smart);
+    tbl.write(wr,true);
+    for (int threads=1;threads<=3;threads++) {
+      csv_outbuf out;
+      const bool err=tbl.write_parallel(out,true,threads,'"',';',smart);
+      assert( (!err)&&(out.size()==wr.output().size())&&
+              (memcmp(out.data(),wr.output().data(),out.size())==0) );
+    }
+  }
+}
+// }}}
+
+static void check_types() // {{{
+{
+  SimpleCSV::Table tbl;
+  SimpleCSV::builder bld(tbl,true);
+  csvparser cp(bld);
+  cp("i,d,b,s,nan,inf\n"
+     "1,1.5,true,5 ,nan,inf\n"
+     "-7,-2e3,FALSE,12abc,1,-Infinity\n"
+     "99999999999,3,true, 7,NaN,1e3\n");
+  cp.finish();
+  SimpleCSV::Table::IBuild::inferTypes(tbl);
+  assert( (tbl.type(0)==SimpleCSV::Int64)&&(tbl.type(1)==SimpleCSV::Double)&&(tbl.type(2)==SimpleCSV::Bool) );
+  assert( (tbl.type(3)==SimpleCSV::String)&&(tbl.type(4)==SimpleCSV::String)&&(tbl.type(5)==SimpleCSV::String) );
+
+  // typed: native (asInt() clamped); untyped: like atoi / atof
+  assert( (tbl[1][0].asInt()==-7)&&(tbl[2][0].asInt64()==99999999999LL)&&(tbl[2][0].asInt()==INT_MAX) );
+  assert( (tbl[0][1].asInt()==1)&&(tbl[1][1].asInt64()==-2000)&&(tbl[0][1].asDouble()==1.5) );
+  assert( (tbl[0][2].asBool())&&(!tbl[1][2].asBool()) );
+  assert( (tbl[0][3].asInt()==5)&&(tbl[1][3].asInt()==12)&&(tbl[2][3].asInt()==7)&&(tbl[0][4].asInt()==0) );
+  assert( (tbl[1][3].asDouble()==12.0)&&(tbl[2][5].asDouble()==1000.0) );
+
+  int64_t ival;
+  double dval;
+  assert( (!tbl[0][3].toInt64(ival))&&(!tbl[0][4].toDouble(dval))&&(!tbl[1][5].toDouble(dval)) );
+  assert( (tbl[2][5].toDouble(dval))&&(dval==1000.0)&&(!tbl[0][5].toInt64(ival)) );
+}
+// }}}
+
+static void check_snapshot() // {{{
+{
+  SimpleCSV::Table tbl;
+  SimpleCSV::builder bld(tbl,true);
+  csvparser cp(bld);
+  cp("id,name,val,flag\n1,\"a,b\",1.5,true\n2,,2.25,false\n3,\"\",,true\n4,x\n");
+  cp.finish();
+  SimpleCSV::Table::IBuild::inferTypes(tbl);
+  SimpleCSV::Table::IBuild::addIndex(tbl,0);
+  SimpleCSV::Table::IBuild::deleteRow(tbl,1);
+
+  const char *fname="tst_csv.snap";
+  assert(!tbl.saveSnapshot(fname));
+  SimpleCSV::Table snap;
+  assert(!SimpleCSV::Table::IBuild::loadSnapshot(snap,fname));
+  unlink(fname);
+
+  csv_writer<csv_outbuf> w0,w1;
+  tbl.write(w0,true);
+  snap.write(w1,true);
+  assert( (w0.output().size()==w1.output().size())&&
+          (memcmp(w0.output().data(),w1.output().data(),w0.output().size())==0) );
+  assert( (snap.size()==3)&&(snap.type(2)==tbl.type(2))&&(snap[2].size()==2) );
+  assert( (snap[1][1].isNull()==tbl[1][1].isNull())&&(!snap[1][1].isNull())&&(snap[2][2].isNull()) );
+  assert( (snap[0][snap.column("val")].asDouble()==1.5)&&(snap[1]["id"].asInt()==3) );
+  std::vector<int> found;
+  snap.lookup(0,"4",found);
+  assert( (found.size()==1)&&(found[0]==2) );
+  bool thrown=false;
+  try {
+    SimpleCSV::Table::IBuild::deleteRow(snap,0);
+  } catch (const std::logic_error &) {
+    thrown=true;
+  }
+  assert(thrown);
+
+  SimpleCSV::Table missing;
+  assert(SimpleCSV::Table::IBuild::loadSnapshot(missing,fname)); // (unlinked)
+
+  // corrupt cell offsets of "id" ("1","3","4": 0,2,4,6) are rejected
+  assert(!tbl.saveSnapshot(fname));
+  std::string data;
+  FILE *f=fopen(fname,"rb");
+  assert(f);
+  char buf[4096];
+  for (size_t len;(len=fread(buf,1,sizeof(buf),f))>0;) {
+    data.append(buf,len);
+  }
+  fclose(f);
+  const uint64_t offs[4]={0,2,4,6};
+  const size_t at=data.find(std::string((const char *)offs,sizeof(offs)));
+  assert(at!=std::string::npos);
+  const uint64_t bad[]={100,1,1}; // beyond blob, descending, cell without NUL
+  for (int iA=0;iA<3;iA++) {
+    std::string corrupt=data;
+    memcpy(&corrupt[at+(1+iA%2)*sizeof(uint64_t)],&bad[iA],sizeof(uint64_t));
+    f=fopen(fname,"wb");
+    assert( (f)&&(fwrite(corrupt.data(),1,corrupt.size(),f)==corrupt.size())&&(fclose(f)==0) );
+    SimpleCSV::Table loaded;
+    errno=0;
+    assert( (SimpleCSV::Table::IBuild::loadSnapshot(loaded,fname))&&(errno==EINVAL)&&(loaded.size()==0) );
+  }
+  unlink(fname);
+}
+// }}}
+
+static void check_stats() // {{{
+{
+  const char *input="a,\"b\"\"c\",,d\n\"x\",yy\nq,\"z\" w\n";
+  const int len=strlen(input);
+  for (int iA=0;iA<=len;iA++) { // (split in two calls)
+    record_builder r;
+    basic_csvparser<record_builder,csv_timed_stats> cp(r);
+    const char *buf=input;
+    const bool err=cp(buf,iA)||cp(buf,len-iA);
+    const csv_stats &st=cp.stats();
+    assert( (err)&&(st.has_error)&&(st.error_offset==(size_t)(strchr(input,'w')-input)) );
+    assert( (st.error_row==2)&&(st.error_col==1)&&(st.bytes==st.error_offset) );
+    assert( (st.rows==2)&&(st.cells==7)&&(st.quoted_cells==3)&&(st.escaped_quotes==1) );
+    assert( (st.max_cell_len==3)&&(st.builder_ns<=st.total_ns) );
+  }
+
+  null_builder nb;
+  basic_csvparser<null_builder,csv_stats> cp(nb);
+  assert( (!cp("1,2\n3,\"open"))&&(cp.finish()) );
+  assert( (cp.stats().error_offset==11)&&(cp.stats().error_row==1)&&(cp.stats().error_col==1) );
+  cp.reset();
+  assert( (!cp.stats().has_error)&&(cp.stats().bytes==0) );
+}
+// }}}
+
+class record_errors : public csv_error_handler {
+public:
+  void bad_row(const char *errmsg,size_t begin,size_t end) override {
+    ranges.push_back(std::make_pair(begin,end));
+  }
+
+  std::vector<std::pair<size_t,size_t> > ranges;
+};
+
+struct string_out { // csv_writer Output without mark() / rewind()
+  explicit string_out(std::string &str) : str(str) {}
+  void operator()(const char *buf,int len) { str.append(buf,len); }
+  std::string &str;
+};
+
+static void check_lenient() // {{{
+{
+  // (stray qchars inside a skipped row must not swallow the following rows)
+  const char *good[]={"a,b\n","2,ok\n","3,\"m\nl\"\n","6,x\n","7,y\n","8,z\n"},
+             *bad[]={"1,\"x\"y,3\n","5\"6,\"a\nb\",7\n","\"a\" \"b\"\n","ab\"cd\"\n","x,\"q\"z\"\n","4,\"open"};
+  const int num=sizeof(good)/sizeof(*good);
+  std::string input,expected;
+  for (int iA=0;iA<num;iA++) {
+    input+=good[iA];
+    input+=bad[iA];
+    expected+=good[iA];
+  }
+
+  for (size_t iA=0;iA<=input.size();iA++) { // (split in two calls)
+    SimpleCSV::Table tbl;
+    SimpleCSV::builder bld(tbl);
+    record_errors errs;
+    basic_csvparser<csv_builder,csv_stats> cp(bld);
+    cp.set_error_handler(&errs);
+    const char *buf=input.c_str();
+    assert( (!cp(buf,iA))&&(!cp(buf,input.size()-iA))&&(!cp.finish())&&(!cp.error()) );
+
+    csv_writer<csv_outbuf> wr('"',',',true);
+    tbl.write(wr);
+    assert( (tbl.size()==num)&&(std::string(wr.output().data(),wr.output().size())==expected) );
+    assert( (errs.ranges.size()==(size_t)num)&&(cp.stats().bad_rows==(size_t)num)&&(cp.stats().rows==(size_t)num) );
+    for (int iB=0;iB<num;iB++) {
+      assert(input.substr(errs.ranges[iB].first,errs.ranges[iB].second-errs.ranges[iB].first)==bad[iB]);
+    }
+
+    // (rewinds its output)
+    csv_writer<csv_outbuf> wr2('"',',',true);
+    basic_csvparser<csv_writer<csv_outbuf> > cp2(wr2);
+    cp2.set_error_handler(&errs);
+    buf=input.c_str();
+    assert( (!cp2(buf,iA))&&(!cp2(buf,input.size()-iA))&&(!cp2.finish()) );
+    assert(std::string(wr2.output().data(),wr2.output().size())==expected);
+
+    // (keeps the current row itself)
+    std::string str;
+    csv_writer<string_out> wr3((string_out(str)),'"',',',true);
+    basic_csvparser<csv_writer<string_out> > cp3(wr3);
+    cp3.set_error_handler(&errs);
+    buf=input.c_str();
+    assert( (!cp3(buf,iA))&&(!cp3(buf,input.size()-iA))&&(!cp3.finish()) );
+    assert(str==expected);
+  }
+
+  // flushed in tiny blocks: bad rows still retracted
+  FILE *f=tmpfile();
+  assert(f);
+  {
+    csv_outbuf out(f,4);
+    csv_writer<csv_outbuf &> wr(out,'"',',',true);
+    basic_csvparser<csv_writer<csv_outbuf &> > cp(wr);
+    record_errors errs;
+    cp.set_error_handler(&errs);
+    assert( (!cp(input))&&(!cp.finish())&&(!wr.output().flush()) );
+  }
+  std::string out(expected.size()+1,0);
+  rewind(f);
+  assert(fread(&out[0],1,out.size(),f)==expected.size());
+  out.resize(expected.size());
+  assert(out==expected);
+  fclose(f);
+
+  assert( (csv_has_abort_row<SimpleCSV::builder>::value)&&(!csv_has_abort_row<std::string>::value) );
+}
+// }}}
+
+static void gzip_append(std::string &ret,const std::string &input) // {{{
+{
+  z_stream zs;
+  memset(&zs,0,sizeof(zs));
+  assert(deflateInit2(&zs,Z_DEFAULT_COMPRESSION,Z_DEFLATED,15+16,8,Z_DEFAULT_STRATEGY)==Z_OK);
+  std::vector<char> out(deflateBound(&zs,input.size()));
+  zs.next_in=(Bytef *)input.data();
+  zs.avail_in=input.size();
+  zs.next_out=(Bytef *)&out[0];
+  zs.avail_out=out.size();
+  assert(deflate(&zs,Z_FINISH)==Z_STREAM_END);
+  ret.append(&out[0],zs.total_out);
+  deflateEnd(&zs);
+}
+// }}}
+
+static void write_file(const char *filename,const std::string &data) // {{{
+{
+  FILE *f=fopen(filename,"wb");
+  assert( (f)&&(fwrite(data.data(),1,data.size(),f)==data.size())&&(fclose(f)==0) );
+}
+// }}}
+
+static void check_zinput() // {{{
+{
+  std::string text;
+  char buf[64];
+  for (int iA=0;iA<2000;iA++) {
+    snprintf(buf,sizeof(buf),"%d,\"q\"\"%d\",\"multi\nline\",%s\n",iA,iA*3,(iA%5) ? "x" : "");
+    text+=buf;
+  }
+  record_builder r0;
+  csvparser cp0(r0);
+  assert( (!cp0(text))&&(!cp0.finish()) );
+
+  // two concatenated gzip members
+  std::string gz;
+  gzip_append(gz,text.substr(0,text.size()/3));
+  gzip_append(gz,text.substr(text.size()/3));
+  const char *fname="tst_csv.csv.gz";
+  write_file(fname,gz);
+
+  record_builder r1;
+  csvparser cp1(r1);
+  csvfile cf(cp1,4096);
+  assert( (!cf(fname))&&(r1.result==r0.result) );
+
+  for (int plain=0;plain<2;plain++) { // small ring: boundaries everywhere, backpressure
+    if (plain) {
+      write_file(fname,text);
+    }
+    const int fd=open(fname,O_RDONLY);
+    assert(fd>=0);
+    csv_zinput in(7,2);
+    assert(!in.open(fd));
+    std::string out;
+    const char *buf;
+    size_t len;
+    while (in.next(buf,len)) {
+      assert( (len>0)&&(len<=7) );
+      out.append(buf,len);
+    }
+    close(fd);
+    assert( (!in.error())&&(out==text)&&(in.format()==((plain) ? csv_zinput::Plain : csv_zinput::Gzip)) );
+  }
+
+  // csvreader
+  write_file(fname,gz);
+  {
+    const int fd=open(fname,O_RDONLY);
+    csv_zinput in(1000);
+    assert(!in.open(fd));
+    csvreader rd;
+    rd.read_from(in);
+    csv_row row;
+    int count=0;
+    while (rd.next_row(row)) {
+      assert( (row.size()==4)&&(row[2].str()=="multi\nline") );
+      count++;
+    }
+    close(fd);
+    assert( (count==2000)&&(!rd.error()) );
+  }
+
+  // destroyed while the thread waits for more input (pipe, writer still open)
+  for (int plain=0;plain<2;plain++) {
+    int fds[2];
+    assert(pipe(fds)==0);
+    const std::string head=(plain) ? text.substr(0,100) : gz.substr(0,100);
+    assert(write(fds[1],head.data(),head.size())==(ssize_t)head.size());
+    {
+      csv_zinput in(4096);
+      assert(!in.open(fds[0]));
+      usleep(10000); // (let it block)
+    }
+    close(fds[0]);
+    close(fds[1]);
+  }
+
+  // truncated
+  write_file(fname,gz.substr(0,gz.size()-10));
+  record_builder r2;
+  csvparser cp2(r2);
+  csvfile cf2(cp2);
+  assert( (cf2(fname))&&(strstr(cf2.error(),"end of compressed input")) );
+  unlink(fname);
+}
+// }}}
+
+template <typename Dialect>
+static std::string parse_dialect(const std::string &input,const char *expected_err=NULL,bool precompiled=true) // {{{
+{
+  std::string ret;
+  for (size_t iA=0;iA<=input.size();iA++) { // (split in two calls)
+    record_builder r1,r2;
+    basic_csvparser<record_builder,csv_nostats,Dialect> cp1(r1);
+    const char *buf=input.c_str();
+    const bool err1=cp1(buf,iA)||cp1(buf,input.size()-iA)||cp1.finish();
+
+    csvparser_dialect cp2(r2,csv_runtime_dialect(Dialect::qchar(),Dialect::sep(),Dialect::flags()));
+    assert(cp2.precompiled()==precompiled);
+    const bool err2=cp2(input)||cp2.finish();
+
+    // generic fallback
+    record_builder r3;
+    basic_csvparser<record_builder> cp3(r3,csv_runtime_dialect(Dialect::qchar(),Dialect::sep(),Dialect::flags()));
+    const bool err3=cp3(input)||cp3.finish();
+
+    assert( (r1.result==r2.result)&&(r1.result==r3.result)&&(err1==err2)&&(err1==err3) );
+    assert( (err1==(expected_err!=NULL))&&( (!err1)||( (expected_err)&&(strcmp(cp1.error(),expected_err)==0) ) ) );
+    ret=r1.result;
+  }
+  return ret;
+}
+// }}}
+
+static void check_dialect() // {{{
+{
+  assert(parse_dialect<csv_rfc4180>("a, b ,\"c\"\r\n\"x\r\ny\",2\rlast,\"q\"\"\"\n\r\n")==
+         "[a| b |c|]\n[x\r\ny|2|]\n[last|q\"|]\n[]\n");
+  parse_dialect<csv_rfc4180>("a, \"b\"\n","unexpected quote in unquoted string");
+  assert(parse_dialect<csv_tsv>("a b\t c\t\"d\"\r\n")=="[a b| c|d|]\n");
+  assert(parse_dialect<csv_semicolon>(" a ; \"b\" ;c\r\n")=="[a |b|c|]\n");
+  parse_dialect<csv_semicolon>("a  \"b\"\r\n","unexpected quote after unquoted string");
+  typedef csv_dialect<'\'','|',csv_trim|csv_trim_tab|csv_quote_in_unquoted> custom;
+  assert(parse_dialect<custom>("\t5' x |\t'a|b' \t|\n",NULL,false)=="[5' x |a|b|(null)|]\n");
+  parse_dialect<csv_dialect<'"',',',csv_trim_tab> >("a\t\"","unexpected quote after unquoted string",false);
+
+  // not precompiled
+  record_builder r;
+  csvparser_dialect cp(r,csv_runtime_dialect('\'',';'));
+  assert( (!cp.precompiled())&&(!cp("a; 'b'\n"))&&(r.result=="[a|b|]\n") );
+}
+// }}}
+
+static void reader_drain(csvreader &rd,record_builder &r,int max_rows=-1) // {{{
+{
+  csv_row row;
+  for (;(max_rows!=0)&&(rd.next_row(row));max_rows--) {
+    r.begin_row();
+    for (int iA=0;iA<row.size();iA++) {
+      r.cell((row[iA].isNull()) ? NULL : row[iA].buf,row[iA].len);
+    }
+    r.end_row();
+  }
+}
+// }}}
+
+// csvparallel (both overloads) vs. csvparser; more than one 4 MB chunk, quoted newlines
+// and doubled qchars everywhere (shifted by pad, i.e. also at the split points)
+// csvparallel (ordered and one builder per chunk) vs. csvparser
+static void parallel_input(const std::string &input,bool bad) // {{{
+{
+  record_builder r0;
+  csvparser cp0(r0);
+  const char *pos=input.data();
+  const bool err0=cp0(pos,input.size())||cp0.finish();
+  assert(err0==bad);
+
+  for (int threads=2;threads<=3;threads++) {
+    csvparallel par('"',',',threads);
+    record_builder r1;
+    const bool err1=par(r1,input.data(),input.size());
+    assert( (err1==err0)&&(r1.result==r0.result) );
+    assert( (!err0)||(strcmp(par.error(),cp0.error())==0) );
+
+    std::vector<record_builder> rs(2*threads+1);
+    std::vector<csv_builder *> outs;
+    for (size_t iB=0;iB<rs.size();iB++) {
+      outs.push_back(&rs[iB]);
+    }
+    const bool err2=par(outs,input.data(),input.size());
+    assert(err2==err0);
+    if (err0) {
+      assert(strcmp(par.error(),cp0.error())==0);
+    } else {
+      std::string all;
+      for (size_t iB=0;iB<rs.size();iB++) {
+        all+=rs[iB].result;
+      }
+      assert(all==r0.result);
+    }
+  }
+}
+// }}}
+
+static void check_parallel() // {{{
+{
+  std::string body;
+  char buf[64];
+  for (int iA=0;body.size()<9*1024*1024;iA++) {
+    snprintf(buf,sizeof(buf),"%d,\"q\"\"%d\n,x\",%s\n",iA,iA%97,(iA%3) ? "plain" : "");
+    body+=buf;
+  }
+
+  for (int pad=0;pad<12;pad+=5) {
+    parallel_input(std::string(pad,'p')+",h\n"+body,false);
+  }
+  { // (stray qchar: wrong parity for all later split points)
+    std::string input=body;
+    input.insert(input.find('\n',input.size()*3/5)+1,"1,ab\"c,2\n");
+    parallel_input(input,true);
+  }
+
+  // unterminated last row, also longer than a chunk (ends after later split points)
+  parallel_input("a\nb",false);
+  parallel_input(body.substr(0,body.size()-1),false);
+  const size_t cut=body.rfind(",plain\n",5*1024*1024)+7;
+  parallel_input(body.substr(0,cut)+"x,"+std::string(4*1024*1024+100,'y'),false);
+}
+// }}}
+
+// csvreader (input split in two chunks, at every position) vs. csvparser;
+// drained after each chunk, partially (one row) or only at the end (rows are queued)
+static void reader_chunks(const char *input) // {{{
+{
+  const int len=strlen(input);
+  record_builder r0;
+  csvparser cp0(r0,'\'');
+  const char *buf=input;
+  const bool err0=cp0(buf,len)||cp0.finish();
+  // (reader only returns complete rows)
+  const size_t rowend=r0.result.rfind("]\n");
+  r0.result.resize((rowend==std::string::npos) ? 0 : rowend+2);
+
+  for (int iA=0;iA<=len;iA++) {
+    for (int drain=0;drain<3;drain++) {
+      record_builder r1;
+      csvreader rd('\'');
+      bool err1=rd.feed(input,iA);
+      if (drain<2) {
+        reader_drain(rd,r1,(drain==0) ? -1 : 1);
+      }
+      err1|=rd.feed(input+iA,len-iA);
+      if (drain==0) {
+        reader_drain(rd,r1);
+      }
+      err1|=rd.finish();
+      reader_drain(rd,r1);
+      if ( (r0.result!=r1.result)||(err0!=err1) ) {
+        fprintf(stderr,"reader mismatch at %d (drain %d) for: %s\n%s---\n%s",iA,drain,input,r0.result.c_str(),r1.result.c_str());
+        assert(0);
+      }
+    }
+  }
+}
+// }}}
+
 struct file_out {
   file_out(FILE *f) : f(f) { assert(f); }
 
@@ -42,6 +821,23 @@ private:
 
 int main(int argc,char **argv)
 {
+  if (argc>1) { // re-emit file ("-": stdin)
+    csv_outbuf out(stdout);
+    csv_writer<csv_outbuf &> wr(out);
+    csvparser cp(wr);
+    cp.set_zero_copy(true);
+    csvfile cf(cp);
+    const bool err=(strcmp(argv[1],"-")==0) ? cf(0) : cf(argv[1]);
+    if (err) {
+      fprintf(stderr,"Error: %s\n",cf.error());
+      return 1;
+    } else if (wr.output().flush()) {
+      fprintf(stderr,"Write error\n");
+      return 1;
+    }
+    return 0;
+  }
+
 //  debug_builder dbg;
 //  null_builder dbg;
 //  csv_writer<file_out> dbg((file_out(stdout))); // CPP11: dbg{{stdout}}
@@ -59,10 +855,86 @@ int main(int argc,char **argv)
     ",1,2,3,4\n"
     " asdf, 'asd''df', s\n"
   );
+  cp.finish();
 
   csv_writer<file_out> dbg2(file_out(stdout),'\'',',',true);
   tbl.write(dbg2);
 
+  { // projected SimpleCSV::Table, by header names
+    SimpleCSV::Table ptbl;
+    SimpleCSV::builder pbld(ptbl,true);
+    std::vector<std::string> names;
+    names.push_back("D");
+    names.push_back("b");
+    pbld.project(names);
+    csvparser pcp(pbld);
+    pcp.set_projection(pbld.projection());
+    pcp("a,b,c,d,e\n1,2,3,4,5\n6,7\n8,9,\"x\"\"y\",10\n");
+    pcp.finish();
+    assert( (ptbl.size()==3)&&(ptbl[0].size()==2)&&(ptbl[1].size()==1) );
+    assert( (ptbl[0]["b"].asInt()==2)&&(ptbl[0]["d"].asInt()==4)&&(ptbl[2][1].asInt()==10) );
+
+    const SimpleCSV::Column cd=ptbl.column("D"),cx=ptbl.column("x");
+    assert( (cd.valid())&&(cd.index()==1)&&(!cx.valid()) );
+    assert( (ptbl[2][cd].asInt()==10)&&(ptbl[2][cx].isNull()) );
+  }
+
+  for (int wired=0;wired<2;wired++) { // predicates, with and without parser projection
+    SimpleCSV::Table ftbl;
+    SimpleCSV::builder fbld(ftbl,true);
+    std::vector<int> cidxs; // (with the predicates: 1,3,5, i.e. sparse, not a prefix)
+    cidxs.push_back(5);
+    cidxs.push_back(3);
+    fbld.project(cidxs);
+    fbld.where("Status",SimpleCSV::Predicate::equal("OK"));
+    fbld.where(3,SimpleCSV::Predicate::range(10,20));
+    csvparser fcp(fbld);
+    if (wired) {
+      fcp.set_projection(fbld.projection());
+    }
+    fcp("id,status,a,ts,b,x\n"
+        "1,OK,p,15,q,a\n"
+        "2,FAIL,p,15,q,b\n"
+        "3,OK,p,25,q,c\n"
+        "4,OK\n"
+        "5,OK,p,10,q,\"d\"\"\"\n"
+        "6,OK,p,x,q,e\n");
+    fcp.finish();
+    assert( (ftbl.size()==2)&&(ftbl[0].size()==2)&&(!ftbl.column("id").valid()) );
+    assert( (ftbl[0]["ts"].asInt()==15)&&(ftbl[0]["x"].asString()=="a") );
+    assert( (ftbl[1]["ts"].asInt()==10)&&(ftbl[1]["x"].asString()=="d\"") );
+  }
+
+  check_indexes();
+  check_types();
+  check_row_edits();
+  check_write_parallel();
+  check_snapshot();
+  check_stats();
+  check_lenient();
+  check_zinput();
+  check_dialect();
+  check_parallel();
+
+  static const char *const inputs[]={
+    "\n1, 's' , 3,4   a\n,1,2,3,4\n asdf, 'asd''df', s\n",
+    "a,b ,  c  d ,,\n''\n'x\ny',' ,'\n",
+    "'abc' x\n", "'abc'x\n", "ab'c\n", "ab 'c\n", "'a' '\n",
+    "a,b", "'unterminated,\n",
+    "0123456789abcdefghijklmnopqrstuvwxyz0123456789,'0123456789abcdefghijklmnopqrstuvwxyz,0123456789'\n"
+    "0123456789abcdefghijklmnopqrstuvwxyz 0123456789 abcdefghijklmnopqrstuvwxyz,0123456789abcdefghijklmnopqr'stuvwxyz\n"
+  };
+  for (int impl=csv_scanner::Scalar;impl<=csv_scanner::best();impl++) {
+    csv_scanner::use((csv_scanner::Impl)impl);
+    for (unsigned int iA=0;iA<sizeof(inputs)/sizeof(*inputs);iA++) {
+      diff_fsm(inputs[iA]);
+      split_chunks(inputs[iA]);
+      reader_chunks(inputs[iA]);
+      projection_chunks(inputs[iA]);
+    }
+  }
+  csv_scanner::use(csv_scanner::best());
+
   return 0;
 }
 